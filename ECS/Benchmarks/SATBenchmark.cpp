@@ -0,0 +1,216 @@
+// Times the OBB narrowphase per candidate pair, the way CollisionSystem used to run it against the
+// way it runs it now, and counts the heap allocations each makes. The old path is kept here as it
+// was: corners recomputed for every projection, axes returned in std::vectors, and the SAT run a
+// second time for every overlapping pair to resolve it. The new path works out each collider's
+// OBBShape once per frame and tests every pair once, one at a time or batched.
+//
+// Usage: SATBenchmark [colliders] [frames]
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <new>
+#include <vector>
+#include "../ECS/SAT.h"
+
+using namespace PC;
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+	allocations++;
+	if (void* ptr = std::malloc(size ? size : 1)) {
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+	std::free(ptr);
+}
+
+namespace {
+	// The narrowphase as it was before OBBShape
+	namespace Legacy {
+		void projectOntoAxis(const OBB& obb, const Vector2f& axis, float& min, float& max) {
+			Vector2f vertices[4];
+			obb.getVertices(vertices);
+			min = max = axis.dotProduct(vertices[0]);
+			for (int i = 1; i < 4; i++) {
+				float projection = axis.dotProduct(vertices[i]);
+				if (projection < min) min = projection;
+				else if (projection > max) max = projection;
+			}
+		}
+
+		std::vector<Vector2f> getAxes(const OBB& obb) {
+			Vector2f vertices[4];
+			obb.getVertices(vertices);
+			Vector2f edges[2] = { vertices[1] - vertices[0], vertices[3] - vertices[0] };
+			std::vector<Vector2f> axes;
+			for (int i = 0; i < 2; i++) {
+				axes.push_back(Vector2f(-edges[i].y, edges[i].x).normalize());
+			}
+			return axes;
+		}
+
+		bool checkOBBCollisionAndGetMTV(const OBB& obbA, const OBB& obbB, Vector2f& mtv) {
+			float minOverlap = std::numeric_limits<float>::max();
+			std::vector<Vector2f> axes = getAxes(obbA);
+			std::vector<Vector2f> axesB = getAxes(obbB);
+			axes.insert(axes.end(), axesB.begin(), axesB.end());
+
+			for (Vector2f& axis : axes) {
+				float minA, maxA, minB, maxB;
+				projectOntoAxis(obbA, axis, minA, maxA);
+				projectOntoAxis(obbB, axis, minB, maxB);
+				float overlap = std::min(maxA, maxB) - std::max(minA, minB);
+				if (overlap <= 0) {
+					return false;
+				}
+				if (overlap < minOverlap) {
+					minOverlap = overlap;
+					mtv = maxB - minA < maxA - minB ? -axis * overlap : axis * overlap;
+				}
+			}
+			return true;
+		}
+	}
+
+	struct Result {
+		double nanosecondsPerPair = 0.0;
+		double allocationsPerPair = 0.0;
+		size_t allocations = 0; // Over every frame
+		size_t hits = 0;
+	};
+
+	template <typename Func>
+	Result measure(size_t pairCount, int frames, Func&& frame) {
+		Result result;
+		allocations = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < frames; i++) {
+			result.hits = frame();
+		}
+		auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		double pairs = static_cast<double>(pairCount) * frames;
+		result.nanosecondsPerPair = elapsed / pairs;
+		result.allocations = allocations;
+		result.allocationsPerPair = allocations / pairs;
+		return result;
+	}
+
+	void print(const char* name, const Result& result) {
+		std::printf("%-28s %8.1f ns/pair %8.2f allocations/pair (%zu in all) %8zu hits\n",
+			name, result.nanosecondsPerPair, result.allocationsPerPair, result.allocations, result.hits);
+	}
+}
+
+int main(int argc, char** argv) {
+	size_t colliderCount = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+	int frames = argc > 2 ? std::atoi(argv[2]) : 100;
+
+	// Boxes of mixed sizes and rotations, packed closely enough that about half the candidate pairs
+	// really overlap
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> position(0.0f, 40.0f * std::sqrt(static_cast<float>(colliderCount)));
+	std::uniform_real_distribution<float> size(10.0f, 40.0f);
+	std::uniform_real_distribution<float> angle(0.0f, static_cast<float>(2.0 * M_PI));
+	std::vector<OBB> obbs;
+	for (size_t i = 0; i < colliderCount; i++) {
+		float c = std::cos(angle(random)), s = std::sin(angle(random));
+		obbs.emplace_back(Vector2f(position(random), position(random)), Vector2f(size(random), size(random)),
+			Matrix3x3f({ { c, -s, 0.0f }, { s, c, 0.0f }, { 0.0f, 0.0f, 1.0f } }));
+	}
+
+	// Candidate pairs are the ones whose bounds overlap, as the broadphase would report them
+	std::vector<AABB> bounds;
+	for (const OBB& obb : obbs) {
+		bounds.push_back(obb.getBounds());
+	}
+	std::vector<ProxyPair> pairs;
+	for (uint32_t a = 0; a < colliderCount; a++) {
+		for (uint32_t b = a + 1; b < colliderCount; b++) {
+			if (bounds[a].overlaps(bounds[b])) {
+				pairs.emplace_back(a, b);
+			}
+		}
+	}
+	std::printf("%zu colliders, %zu candidate pairs, %d frames\n", colliderCount, pairs.size(), frames);
+	if (pairs.empty()) {
+		return 0;
+	}
+
+	// Every path must find the same overlaps and MTVs
+	std::vector<Vector2f> legacyMtv(pairs.size()), mtv(pairs.size());
+	std::vector<bool> legacyHit(pairs.size());
+
+	Result legacy = measure(pairs.size(), frames, [&] {
+		size_t hits = 0;
+		for (size_t i = 0; i < pairs.size(); i++) {
+			const OBB& a = obbs[pairs[i].first];
+			const OBB& b = obbs[pairs[i].second];
+			Vector2f found;
+			legacyHit[i] = Legacy::checkOBBCollisionAndGetMTV(a, b, found);
+			if (legacyHit[i]) {
+				// Resolving the collision ran the whole test again
+				Legacy::checkOBBCollisionAndGetMTV(a, b, found);
+				legacyMtv[i] = found;
+				hits++;
+			}
+		}
+		return hits;
+	});
+
+	std::vector<OBBShape> shapes(colliderCount);
+	Result single = measure(pairs.size(), frames, [&] {
+		for (size_t i = 0; i < colliderCount; i++) {
+			shapes[i] = OBBShape(obbs[i]);
+		}
+		size_t hits = 0;
+		for (size_t i = 0; i < pairs.size(); i++) {
+			if (BatchSAT::test(shapes[pairs[i].first], shapes[pairs[i].second], mtv[i])) {
+				hits++;
+			}
+		}
+		return hits;
+	});
+
+	BatchSAT sat;
+	std::vector<SATHit> hits;
+	hits.reserve(pairs.size());
+	Result batched = measure(pairs.size(), frames, [&] {
+		for (size_t i = 0; i < colliderCount; i++) {
+			shapes[i] = OBBShape(obbs[i]);
+		}
+		hits.clear();
+		sat.run(shapes.data(), pairs.data(), pairs.size(), hits);
+		return hits.size();
+	});
+
+	print("old, SAT twice per hit", legacy);
+	print("OBBShape, once per pair", single);
+	print("OBBShape, batched", batched);
+	std::printf("speedup %.2fx once per pair, %.2fx batched\n",
+		legacy.nanosecondsPerPair / single.nanosecondsPerPair, legacy.nanosecondsPerPair / batched.nanosecondsPerPair);
+
+	size_t mismatches = 0;
+	size_t next = 0;
+	for (size_t i = 0; i < pairs.size(); i++) {
+		bool batchedHit = next < hits.size() && hits[next].pair == i;
+		Vector2f batchedMtv = batchedHit ? hits[next++].mtv : Vector2f();
+		if (batchedHit != legacyHit[i] || (batchedHit && (batchedMtv.x != legacyMtv[i].x || batchedMtv.y != legacyMtv[i].y ||
+			mtv[i].x != legacyMtv[i].x || mtv[i].y != legacyMtv[i].y))) {
+			mismatches++;
+		}
+	}
+	if (mismatches || legacy.hits != single.hits || legacy.hits != batched.hits) {
+		std::printf("MISMATCH: %zu pairs differ from the old path\n", mismatches);
+		return 1;
+	}
+	return 0;
+}
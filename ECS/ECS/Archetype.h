@@ -0,0 +1,322 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <array>
+#include <memory>
+#include <new>
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <tuple>
+#include <iterator>
+#include "ComponentType.h"
+
+class Entity;
+
+// Type-erased description of a component type, enough for an archetype to lay it out in a
+// column and to move or destroy it without knowing the concrete type.
+struct ComponentInfo {
+    ComponentType type;
+    size_t size;
+    size_t alignment;
+    void (*moveConstruct)(void* dst, void* src);
+    void (*destroy)(void* ptr);
+
+    template <typename T>
+    static const ComponentInfo* of() {
+        static const ComponentInfo info{
+            ComponentTypeId<T>::get(), sizeof(T), alignof(T),
+            [](void* dst, void* src) { new (dst) T(std::move(*static_cast<T*>(src))); },
+            [](void* ptr) { static_cast<T*>(ptr)->~T(); }
+        };
+        return &info;
+    }
+};
+
+// An archetype holds every entity that has exactly the same set of components. Rows are stored in
+// fixed-size chunks, and each chunk is laid out as structure-of-arrays: one contiguous column per
+// component type plus a column of owning entities. Growing an archetype allocates a new chunk, so
+// existing rows never move; removing a row moves the last row into the hole (swap-and-pop).
+class Archetype {
+public:
+    static constexpr size_t ChunkSize = 16 * 1024;
+    static constexpr size_t ChunkAlignment = 64;
+
+    Archetype(std::vector<const ComponentInfo*> componentInfos) : infos(std::move(componentInfos)), count(0) {
+        columnIndex.fill(-1);
+        addEdges.fill(nullptr);
+        removeEdges.fill(nullptr);
+        for (size_t i = 0; i < infos.size(); i++) {
+            types.push_back(infos[i]->type);
+            columnIndex[infos[i]->type] = static_cast<int>(i);
+        }
+
+        // Work out how many rows fit in a chunk, leaving room to align every column to a cache line
+        size_t rowSize = sizeof(Entity*);
+        for (const ComponentInfo* info : infos) {
+            rowSize += info->size;
+        }
+        size_t padding = (infos.size() + 1) * ChunkAlignment;
+        capacity = ChunkSize > padding + rowSize ? (ChunkSize - padding) / rowSize : 1;
+
+        size_t offset = alignUp(capacity * sizeof(Entity*));
+        for (const ComponentInfo* info : infos) {
+            offsets.push_back(offset);
+            offset = alignUp(offset + capacity * info->size);
+        }
+        chunkBytes = offset;
+    }
+
+    ~Archetype() {
+        clear();
+        for (unsigned char* chunk : chunks) {
+            ::operator delete(chunk, std::align_val_t(ChunkAlignment));
+        }
+    }
+
+    Archetype(const Archetype&) = delete;
+    Archetype& operator=(const Archetype&) = delete;
+
+    const std::vector<ComponentType>& getTypes() const {
+        return types;
+    }
+
+    const ComponentInfo* getInfo(size_t column) const {
+        return infos[column];
+    }
+
+    int columnOf(ComponentType type) const {
+        return columnIndex[type];
+    }
+
+    bool has(ComponentType type) const {
+        return columnIndex[type] >= 0;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    size_t getChunkCapacity() const {
+        return capacity;
+    }
+
+    // Rows the allocated chunks can hold, occupied or not
+    size_t reservedRows() const {
+        return chunks.size() * capacity;
+    }
+
+    size_t chunkCount() const {
+        return (count + capacity - 1) / capacity;
+    }
+
+    // Number of occupied rows in the given chunk
+    size_t chunkSize(size_t chunk) const {
+        return std::min(capacity, count - chunk * capacity);
+    }
+
+    Entity** chunkEntities(size_t chunk) const {
+        return reinterpret_cast<Entity**>(chunks[chunk]);
+    }
+
+    void* chunkColumn(size_t chunk, size_t column) const {
+        return chunks[chunk] + offsets[column];
+    }
+
+    void* get(size_t column, size_t row) const {
+        return chunks[row / capacity] + offsets[column] + (row % capacity) * infos[column]->size;
+    }
+
+    Entity* entityAt(size_t row) const {
+        return chunkEntities(row / capacity)[row % capacity];
+    }
+
+    // Reserves a row for the entity. The caller is responsible for constructing every column.
+    size_t pushRow(Entity* entity) {
+        if (count == chunks.size() * capacity) {
+            chunks.push_back(static_cast<unsigned char*>(::operator new(chunkBytes, std::align_val_t(ChunkAlignment))));
+        }
+        size_t row = count++;
+        chunkEntities(row / capacity)[row % capacity] = entity;
+        return row;
+    }
+
+    // Moves every component of the row into the destination row, dropping the ones the destination
+    // archetype does not have, then removes the row. Returns the entity that was swapped into it.
+    Entity* moveRowTo(size_t row, Archetype& destination, size_t destinationRow) {
+        for (size_t column = 0; column < infos.size(); column++) {
+            void* source = get(column, row);
+            int destinationColumn = destination.columnOf(types[column]);
+            if (destinationColumn >= 0) {
+                infos[column]->moveConstruct(destination.get(destinationColumn, destinationRow), source);
+            }
+            infos[column]->destroy(source);
+        }
+        return removeRow(row, false);
+    }
+
+    // Removes a row by moving the last row into its place. Returns the entity that was moved into
+    // the row, or nullptr if the removed row was the last one.
+    Entity* removeRow(size_t row, bool destroyComponents = true) {
+        size_t last = count - 1;
+        Entity* moved = nullptr;
+
+        for (size_t column = 0; column < infos.size(); column++) {
+            void* target = get(column, row);
+            if (destroyComponents) {
+                infos[column]->destroy(target);
+            }
+            if (row != last) {
+                void* source = get(column, last);
+                infos[column]->moveConstruct(target, source);
+                infos[column]->destroy(source);
+            }
+        }
+
+        if (row != last) {
+            moved = entityAt(last);
+            chunkEntities(row / capacity)[row % capacity] = moved;
+        }
+        count--;
+        return moved;
+    }
+
+    // Destroys every row, keeping the chunks around for reuse
+    void clear() {
+        for (size_t row = 0; row < count; row++) {
+            for (size_t column = 0; column < infos.size(); column++) {
+                infos[column]->destroy(get(column, row));
+            }
+        }
+        count = 0;
+    }
+
+    // Cached transitions to the archetype reached by adding or removing a component type
+    std::array<Archetype*, MaxComponentTypes> addEdges;
+    std::array<Archetype*, MaxComponentTypes> removeEdges;
+
+private:
+    static size_t alignUp(size_t value) {
+        return (value + ChunkAlignment - 1) & ~(ChunkAlignment - 1);
+    }
+
+    std::vector<const ComponentInfo*> infos;
+    std::vector<ComponentType> types;
+    std::array<int, MaxComponentTypes> columnIndex;
+    std::vector<size_t> offsets;
+    std::vector<unsigned char*> chunks;
+    size_t capacity;
+    size_t chunkBytes;
+    size_t count;
+};
+
+class ArchetypeStorage {
+public:
+    // Returns the archetype reached by adding T to the given archetype (nullptr is the empty set)
+    template <typename T>
+    Archetype* withComponent(Archetype* from) {
+        ComponentType type = ComponentTypeId<T>::get();
+        if (from && from->addEdges[type]) {
+            return from->addEdges[type];
+        }
+
+        std::vector<const ComponentInfo*> infos;
+        if (from) {
+            for (size_t column = 0; column < from->getTypes().size(); column++) {
+                infos.push_back(from->getInfo(column));
+            }
+        }
+        infos.push_back(ComponentInfo::of<T>());
+
+        Archetype* archetype = findOrCreate(std::move(infos));
+        if (from) {
+            from->addEdges[type] = archetype;
+        }
+        return archetype;
+    }
+
+    // Returns the archetype reached by removing T from the given archetype, or nullptr if nothing is left
+    template <typename T>
+    Archetype* withoutComponent(Archetype* from) {
+        ComponentType type = ComponentTypeId<T>::get();
+        if (from->removeEdges[type]) {
+            return from->removeEdges[type];
+        }
+
+        std::vector<const ComponentInfo*> infos;
+        for (size_t column = 0; column < from->getTypes().size(); column++) {
+            if (from->getTypes()[column] != type) {
+                infos.push_back(from->getInfo(column));
+            }
+        }
+        if (infos.empty()) {
+            return nullptr;
+        }
+
+        Archetype* archetype = findOrCreate(std::move(infos));
+        from->removeEdges[type] = archetype;
+        return archetype;
+    }
+
+    // Calls func(Ts&...) for every entity that has all of the given components, walking each
+    // matching archetype chunk by chunk so the columns are read linearly.
+    template <typename... Ts, typename Func>
+    void each(Func&& func) {
+        for (auto& [types, archetype] : archetypes) {
+            int columns[] = { archetype->columnOf(ComponentTypeId<Ts>::get())... };
+            if (std::find(std::begin(columns), std::end(columns), -1) != std::end(columns)) {
+                continue;
+            }
+            for (size_t chunk = 0; chunk < archetype->chunkCount(); chunk++) {
+                eachInChunk<Ts...>(*archetype, chunk, columns, func, std::index_sequence_for<Ts...>{});
+            }
+        }
+    }
+
+    // Calls func(Archetype&) for every archetype that has all of the given components
+    template <typename... Ts, typename Func>
+    void eachArchetype(Func&& func) {
+        for (auto& [types, archetype] : archetypes) {
+            if ((archetype->has(ComponentTypeId<Ts>::get()) && ...)) {
+                func(*archetype);
+            }
+        }
+    }
+
+    // Destroys every component of every archetype
+    void clear() {
+        for (auto& [types, archetype] : archetypes) {
+            archetype->clear();
+        }
+    }
+
+private:
+    Archetype* findOrCreate(std::vector<const ComponentInfo*> infos) {
+        std::sort(infos.begin(), infos.end(), [](const ComponentInfo* a, const ComponentInfo* b) { return a->type < b->type; });
+
+        std::vector<ComponentType> key;
+        for (const ComponentInfo* info : infos) {
+            key.push_back(info->type);
+        }
+
+        auto iter = archetypes.find(key);
+        if (iter != archetypes.end()) {
+            return iter->second.get();
+        }
+        auto archetype = std::make_unique<Archetype>(std::move(infos));
+        Archetype* result = archetype.get();
+        archetypes.emplace(std::move(key), std::move(archetype));
+        return result;
+    }
+
+    template <typename... Ts, typename Func, size_t... Is>
+    void eachInChunk(Archetype& archetype, size_t chunk, const int* columns, Func& func, std::index_sequence<Is...>) {
+        std::tuple<Ts*...> data(static_cast<Ts*>(archetype.chunkColumn(chunk, columns[Is]))...);
+        size_t rows = archetype.chunkSize(chunk);
+        for (size_t row = 0; row < rows; row++) {
+            func(std::get<Is>(data)[row]...);
+        }
+    }
+
+    std::map<std::vector<ComponentType>, std::unique_ptr<Archetype>> archetypes;
+};
@@ -0,0 +1,695 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include "PCM.h"
+
+// Axis-aligned bounding box
+struct AABB {
+    PC::Vector2f min;
+    PC::Vector2f max;
+
+    AABB() = default;
+    AABB(const PC::Vector2f& min, const PC::Vector2f& max) : min(min), max(max) {}
+
+    // Touching boxes count as overlapping, so the narrowphase gets to decide about them
+    bool overlaps(const AABB& other) const {
+        return min.x <= other.max.x && other.min.x <= max.x &&
+            min.y <= other.max.y && other.min.y <= max.y;
+    }
+
+    bool contains(const AABB& other) const {
+        return min.x <= other.min.x && min.y <= other.min.y &&
+            other.max.x <= max.x && other.max.y <= max.y;
+    }
+
+    AABB merged(const AABB& other) const {
+        return AABB(PC::Vector2f(std::min(min.x, other.min.x), std::min(min.y, other.min.y)),
+            PC::Vector2f(std::max(max.x, other.max.x), std::max(max.y, other.max.y)));
+    }
+
+    // Box around this one after an affine transform
+    AABB transformed(const PC::Affine2Df& m) const {
+        PC::Vector2f center = m * ((min + max) * 0.5f);
+        PC::Vector2f half = (max - min) * 0.5f;
+        PC::Vector2f extent(std::abs(m.a) * half.x + std::abs(m.b) * half.y, std::abs(m.c) * half.x + std::abs(m.d) * half.y);
+        return AABB(center - extent, center + extent);
+    }
+
+    AABB fattened(float margin) const {
+        return AABB(min - PC::Vector2f(margin, margin), max + PC::Vector2f(margin, margin));
+    }
+
+    // Cost measure of the tree, cheaper to get than the area and better behaved for thin boxes
+    float perimeter() const {
+        return 2.0f * ((max.x - min.x) + (max.y - min.y));
+    }
+
+    // Whether the segment from one point to the other passes through the box (slab test)
+    bool intersectsSegment(const PC::Vector2f& from, const PC::Vector2f& to) const {
+        float enter = 0.0f, exit = 1.0f;
+        float origin[2] = { from.x, from.y };
+        float delta[2] = { to.x - from.x, to.y - from.y };
+        float low[2] = { min.x, min.y };
+        float high[2] = { max.x, max.y };
+        for (int axis = 0; axis < 2; axis++) {
+            if (std::abs(delta[axis]) < 1e-12f) {
+                if (origin[axis] < low[axis] || origin[axis] > high[axis]) {
+                    return false;
+                }
+                continue;
+            }
+            float t1 = (low[axis] - origin[axis]) / delta[axis];
+            float t2 = (high[axis] - origin[axis]) / delta[axis];
+            enter = std::max(enter, std::min(t1, t2));
+            exit = std::min(exit, std::max(t1, t2));
+            if (enter > exit) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Moves this box along motion against a box that stays put. On a hit, toi is the fraction of
+    // motion at first contact and normal the face of the other box that was hit. Boxes that already
+    // overlap don't count, nor does sliding along a face.
+    bool sweep(const AABB& other, const PC::Vector2f& motion, float& toi, PC::Vector2f& normal) const {
+        float enter = -std::numeric_limits<float>::infinity();
+        float exit = 1.0f;
+        int hitAxis = 0;
+        float delta[2] = { motion.x, motion.y };
+        float gapLow[2] = { other.min.x - max.x, other.min.y - max.y }; // Move needed to reach the other box
+        float gapHigh[2] = { other.max.x - min.x, other.max.y - min.y }; // Move needed to get past it
+        for (int axis = 0; axis < 2; axis++) {
+            if (delta[axis] == 0.0f) {
+                if (gapLow[axis] >= 0.0f || gapHigh[axis] <= 0.0f) {
+                    return false;
+                }
+                continue;
+            }
+            float t1 = gapLow[axis] / delta[axis];
+            float t2 = gapHigh[axis] / delta[axis];
+            if (t1 > t2) {
+                std::swap(t1, t2);
+            }
+            if (t1 > enter) {
+                enter = t1;
+                hitAxis = axis;
+            }
+            exit = std::min(exit, t2);
+        }
+        if (enter < 0.0f || enter >= exit) {
+            return false;
+        }
+        toi = enter;
+        normal = PC::Vector2f(0.0f, 0.0f);
+        if (hitAxis == 0) {
+            normal.x = motion.x > 0.0f ? -1.0f : 1.0f;
+        }
+        else {
+            normal.y = motion.y > 0.0f ? -1.0f : 1.0f;
+        }
+        return true;
+    }
+};
+
+// Pairs of proxies whose boxes overlap, as indices into whatever the caller inserted
+using ProxyPair = std::pair<uint32_t, uint32_t>;
+
+// Category and mask bits of a proxy. Two proxies pair up only if each one's category is in the
+// other's mask; the default pairs with everything.
+struct ProxyFilter {
+    uint32_t category = 1;
+    uint32_t mask = ~uint32_t(0);
+
+    bool accepts(const ProxyFilter& other) const {
+        return (category & other.mask) != 0 && (other.category & mask) != 0;
+    }
+};
+
+// Uniform grid broadphase rebuilt from scratch every frame. Each box is binned into every cell it
+// covers, and only boxes sharing a cell are tested against each other, so the cost grows with the
+// number of boxes rather than with its square as long as the cell size is in the range of the box
+// sizes. Cells are hashed into buckets with a counting sort, so after the first frames building
+// and querying the grid allocates nothing.
+class SpatialHashGrid {
+public:
+    explicit SpatialHashGrid(float cellSize = 128.0f) {
+        setCellSize(cellSize);
+    }
+
+    void setCellSize(float size) {
+        cellSize = size > 0.0f ? size : 1.0f;
+        inverseCellSize = 1.0f / cellSize;
+    }
+
+    float getCellSize() const {
+        return cellSize;
+    }
+
+    void clear() {
+        boxes.clear();
+        entries.clear();
+    }
+
+    // Adds a box; proxy is the caller's handle for it and is what findPairs reports
+    void insert(uint32_t proxy, const AABB& box, ProxyFilter filter = ProxyFilter()) {
+        uint32_t slot = static_cast<uint32_t>(boxes.size());
+        boxes.push_back({ proxy, box, filter });
+
+        int minX = cellOf(box.min.x), maxX = cellOf(box.max.x);
+        int minY = cellOf(box.min.y), maxY = cellOf(box.max.y);
+        for (int y = minY; y <= maxY; y++) {
+            for (int x = minX; x <= maxX; x++) {
+                entries.push_back({ x, y, slot });
+            }
+        }
+    }
+
+    // Appends every overlapping pair the filters allow once, the smaller proxy first
+    void findPairs(std::vector<ProxyPair>& pairs) {
+        if (entries.empty()) {
+            return;
+        }
+        bucketEntries();
+
+        for (size_t bucket = 0; bucket + 1 < bucketStart.size(); bucket++) {
+            uint32_t begin = bucketStart[bucket], end = bucketStart[bucket + 1];
+            for (uint32_t i = begin; i < end; i++) {
+                const Entry& a = sorted[i];
+                for (uint32_t j = i + 1; j < end; j++) {
+                    const Entry& b = sorted[j];
+                    if (a.x != b.x || a.y != b.y) {
+                        continue; // Another cell that hashed to the same bucket
+                    }
+                    const Box& boxA = boxes[a.slot];
+                    const Box& boxB = boxes[b.slot];
+                    if (!boxA.filter.accepts(boxB.filter) || !boxA.bounds.overlaps(boxB.bounds)) {
+                        continue;
+                    }
+                    // Boxes sharing several cells are reported only from the cell holding the
+                    // corner of their intersection, so no pair comes out twice
+                    if (cellOf(std::max(boxA.bounds.min.x, boxB.bounds.min.x)) != a.x ||
+                        cellOf(std::max(boxA.bounds.min.y, boxB.bounds.min.y)) != a.y) {
+                        continue;
+                    }
+                    pairs.emplace_back(std::min(boxA.proxy, boxB.proxy), std::max(boxA.proxy, boxB.proxy));
+                }
+            }
+        }
+    }
+
+private:
+    struct Box {
+        uint32_t proxy;
+        AABB bounds;
+        ProxyFilter filter;
+    };
+
+    struct Entry {
+        int x, y;
+        uint32_t slot;
+    };
+
+    int cellOf(float coordinate) const {
+        return static_cast<int>(std::floor(coordinate * inverseCellSize));
+    }
+
+    static uint32_t hashCell(int x, int y) {
+        return static_cast<uint32_t>(x) * 73856093u ^ static_cast<uint32_t>(y) * 19349663u;
+    }
+
+    // Counting sort of the entries by bucket, about two buckets per entry
+    void bucketEntries() {
+        size_t bucketCount = 1;
+        while (bucketCount < entries.size() * 2) {
+            bucketCount <<= 1;
+        }
+        uint32_t mask = static_cast<uint32_t>(bucketCount - 1);
+
+        bucketStart.assign(bucketCount + 1, 0);
+        for (const Entry& entry : entries) {
+            bucketStart[(hashCell(entry.x, entry.y) & mask) + 1]++;
+        }
+        for (size_t i = 1; i <= bucketCount; i++) {
+            bucketStart[i] += bucketStart[i - 1];
+        }
+
+        cursor.assign(bucketStart.begin(), bucketStart.end() - 1);
+        sorted.resize(entries.size());
+        for (const Entry& entry : entries) {
+            sorted[cursor[hashCell(entry.x, entry.y) & mask]++] = entry;
+        }
+    }
+
+    float cellSize;
+    float inverseCellSize;
+    std::vector<Box> boxes;
+    std::vector<Entry> entries;
+    std::vector<Entry> sorted;
+    std::vector<uint32_t> bucketStart;
+    std::vector<uint32_t> cursor;
+};
+
+// Dynamic bounding volume hierarchy over boxes. Leaves hold the boxes, every inner node the union of
+// its two children. Leaves are inserted next to the sibling that grows the tree's total perimeter
+// the least, and the tree is kept balanced with AVL-style rotations on the way back up, so queries
+// stay logarithmic whatever the mix of box sizes.
+class DynamicAABBTree {
+public:
+    static constexpr int Null = -1;
+
+    int createProxy(const AABB& box, uint32_t userData) {
+        int proxy = allocateNode();
+        nodes[proxy].box = box;
+        nodes[proxy].userData = userData;
+        insertLeaf(proxy);
+        proxyCount++;
+        return proxy;
+    }
+
+    void destroyProxy(int proxy) {
+        removeLeaf(proxy);
+        freeNode(proxy);
+        proxyCount--;
+    }
+
+    // Gives a leaf a new box, reinserting it so it finds a better place in the tree
+    void moveProxy(int proxy, const AABB& box) {
+        removeLeaf(proxy);
+        nodes[proxy].box = box;
+        insertLeaf(proxy);
+    }
+
+    const AABB& getBox(int proxy) const {
+        return nodes[proxy].box;
+    }
+
+    uint32_t getUserData(int proxy) const {
+        return nodes[proxy].userData;
+    }
+
+    size_t getProxyCount() const {
+        return proxyCount;
+    }
+
+    int getHeight() const {
+        return root == Null ? 0 : nodes[root].height;
+    }
+
+    // Calls func(proxy) for every leaf whose box overlaps the given one; returning false stops.
+    // Uses a scratch stack owned by the tree, so two queries must not run at once.
+    template <typename Func>
+    void query(const AABB& box, Func&& func) const {
+        traverse([&box](const AABB& nodeBox) { return nodeBox.overlaps(box); }, func);
+    }
+
+    // Calls func(proxy) for every leaf whose box the segment passes through; returning false stops
+    template <typename Func>
+    void rayCast(const PC::Vector2f& from, const PC::Vector2f& to, Func&& func) const {
+        traverse([&from, &to](const AABB& nodeBox) { return nodeBox.intersectsSegment(from, to); }, func);
+    }
+
+    void clear() {
+        nodes.clear();
+        root = Null;
+        freeList = Null;
+        proxyCount = 0;
+    }
+
+private:
+    struct Node {
+        AABB box;
+        int parent = Null; // Next free node while the node is on the free list
+        int child1 = Null;
+        int child2 = Null;
+        int height = 0; // Leaves are 0, free nodes -1
+        uint32_t userData = 0;
+
+        bool isLeaf() const {
+            return child1 == Null;
+        }
+    };
+
+    template <typename Test, typename Func>
+    void traverse(Test&& test, Func& func) const {
+        if (root == Null) {
+            return;
+        }
+        stack.clear();
+        stack.push_back(root);
+        while (!stack.empty()) {
+            const Node& node = nodes[stack.back()];
+            int index = stack.back();
+            stack.pop_back();
+            if (!test(node.box)) {
+                continue;
+            }
+            if (node.isLeaf()) {
+                if (!func(index)) {
+                    return;
+                }
+            }
+            else {
+                stack.push_back(node.child1);
+                stack.push_back(node.child2);
+            }
+        }
+    }
+
+    int allocateNode() {
+        if (freeList == Null) {
+            nodes.emplace_back();
+            return static_cast<int>(nodes.size() - 1);
+        }
+        int index = freeList;
+        freeList = nodes[index].parent;
+        nodes[index] = Node();
+        return index;
+    }
+
+    void freeNode(int index) {
+        nodes[index].parent = freeList;
+        nodes[index].height = -1;
+        freeList = index;
+    }
+
+    void insertLeaf(int leaf) {
+        if (root == Null) {
+            root = leaf;
+            nodes[leaf].parent = Null;
+            return;
+        }
+
+        // Walk down to the cheapest sibling. Going into a child costs the growth of every node on
+        // the way (inherited cost) plus the new parent's perimeter.
+        AABB leafBox = nodes[leaf].box;
+        int index = root;
+        while (!nodes[index].isLeaf()) {
+            const Node& node = nodes[index];
+            float perimeter = node.box.perimeter();
+            float combined = node.box.merged(leafBox).perimeter();
+            float cost = 2.0f * combined; // Make a new parent for this node and the leaf
+            float inherited = 2.0f * (combined - perimeter);
+
+            float cost1 = descendCost(node.child1, leafBox) + inherited;
+            float cost2 = descendCost(node.child2, leafBox) + inherited;
+            if (cost < cost1 && cost < cost2) {
+                break;
+            }
+            index = cost1 < cost2 ? node.child1 : node.child2;
+        }
+
+        int sibling = index;
+        int oldParent = nodes[sibling].parent;
+        int newParent = allocateNode();
+        nodes[newParent].parent = oldParent;
+        nodes[newParent].box = nodes[sibling].box.merged(leafBox);
+        nodes[newParent].height = nodes[sibling].height + 1;
+        nodes[newParent].child1 = sibling;
+        nodes[newParent].child2 = leaf;
+        nodes[sibling].parent = newParent;
+        nodes[leaf].parent = newParent;
+        if (oldParent == Null) {
+            root = newParent;
+        }
+        else if (nodes[oldParent].child1 == sibling) {
+            nodes[oldParent].child1 = newParent;
+        }
+        else {
+            nodes[oldParent].child2 = newParent;
+        }
+
+        refitFrom(nodes[leaf].parent);
+    }
+
+    float descendCost(int child, const AABB& leafBox) const {
+        float merged = nodes[child].box.merged(leafBox).perimeter();
+        return nodes[child].isLeaf() ? merged : merged - nodes[child].box.perimeter();
+    }
+
+    void removeLeaf(int leaf) {
+        if (leaf == root) {
+            root = Null;
+            return;
+        }
+
+        // The sibling takes the parent's place
+        int parent = nodes[leaf].parent;
+        int grandParent = nodes[parent].parent;
+        int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+        if (grandParent == Null) {
+            root = sibling;
+            nodes[sibling].parent = Null;
+            freeNode(parent);
+            return;
+        }
+        if (nodes[grandParent].child1 == parent) {
+            nodes[grandParent].child1 = sibling;
+        }
+        else {
+            nodes[grandParent].child2 = sibling;
+        }
+        nodes[sibling].parent = grandParent;
+        freeNode(parent);
+
+        refitFrom(grandParent);
+    }
+
+    // Rebalances and refits every node from the given one up to the root
+    void refitFrom(int index) {
+        while (index != Null) {
+            index = balance(index);
+            Node& node = nodes[index];
+            node.height = 1 + std::max(nodes[node.child1].height, nodes[node.child2].height);
+            node.box = nodes[node.child1].box.merged(nodes[node.child2].box);
+            index = node.parent;
+        }
+    }
+
+    // If one child of a is more than one level taller than the other, rotates the taller child up
+    // into a's place. Returns the node now at a's position.
+    int balance(int a) {
+        Node& nodeA = nodes[a];
+        if (nodeA.isLeaf() || nodeA.height < 2) {
+            return a;
+        }
+        int b = nodeA.child1;
+        int c = nodeA.child2;
+        int difference = nodes[c].height - nodes[b].height;
+        if (difference > 1) {
+            return rotateUp(a, c, b);
+        }
+        if (difference < -1) {
+            return rotateUp(a, b, c);
+        }
+        return a;
+    }
+
+    // Moves the tall child up above a. Of the tall child's two children, the taller stays under it
+    // and the shorter takes the tall child's old place under a.
+    int rotateUp(int a, int tall, int shortChild) {
+        int f = nodes[tall].child1;
+        int g = nodes[tall].child2;
+
+        // tall replaces a under a's parent, a becomes one of its children
+        nodes[tall].child1 = a;
+        nodes[tall].parent = nodes[a].parent;
+        nodes[a].parent = tall;
+        int parent = nodes[tall].parent;
+        if (parent == Null) {
+            root = tall;
+        }
+        else if (nodes[parent].child1 == a) {
+            nodes[parent].child1 = tall;
+        }
+        else {
+            nodes[parent].child2 = tall;
+        }
+
+        int keep = nodes[f].height > nodes[g].height ? f : g;
+        int give = keep == f ? g : f;
+        nodes[tall].child2 = keep;
+        nodes[a].child1 = shortChild;
+        nodes[a].child2 = give;
+        nodes[give].parent = a;
+
+        nodes[a].box = nodes[shortChild].box.merged(nodes[give].box);
+        nodes[a].height = 1 + std::max(nodes[shortChild].height, nodes[give].height);
+        nodes[tall].box = nodes[a].box.merged(nodes[keep].box);
+        nodes[tall].height = 1 + std::max(nodes[a].height, nodes[keep].height);
+        return tall;
+    }
+
+    std::vector<Node> nodes;
+    int root = Null;
+    int freeList = Null;
+    size_t proxyCount = 0;
+    mutable std::vector<int> stack;
+};
+
+// Broadphase on top of a DynamicAABBTree that persists between frames. The tree stores each box
+// grown by a margin, and a leaf is only reinserted once its box leaves that fat box. Candidate
+// pairs are cached and only the pairs of reinserted or removed boxes are looked up again, so the
+// cost of finding pairs follows how much moves rather than how much there is.
+//
+// Each frame, call update for every live box, then findPairs. Keys are small integers chosen by the
+// caller (they index an array); keys not updated in a frame are dropped from the tree.
+class AABBTreeBroadphase {
+public:
+    explicit AABBTreeBroadphase(float margin = 8.0f) : margin(margin) {}
+
+    void setMargin(float value) {
+        margin = value;
+    }
+
+    float getMargin() const {
+        return margin;
+    }
+
+    void update(uint32_t key, const AABB& box, ProxyFilter filter = ProxyFilter()) {
+        if (key >= proxies.size()) {
+            proxies.resize(key + 1);
+        }
+        Proxy& proxy = proxies[key];
+        proxy.box = box;
+        proxy.filter = filter;
+        proxy.frame = frame;
+        if (proxy.node == DynamicAABBTree::Null) {
+            proxy.node = tree.createProxy(box.fattened(margin), key);
+            proxy.listIndex = static_cast<uint32_t>(keys.size());
+            keys.push_back(key);
+            markDirty(key);
+        }
+        else if (!tree.getBox(proxy.node).contains(box)) {
+            tree.moveProxy(proxy.node, box.fattened(margin));
+            markDirty(key);
+        }
+    }
+
+    // Appends every pair whose current boxes overlap and whose filters allow it, the smaller key
+    // first, and starts a new frame
+    void findPairs(std::vector<ProxyPair>& pairs) {
+        removeStale();
+
+        if (!dirty.empty()) {
+            // Drop the cached pairs of everything that moved or went away, then look them up again
+            pairCache.erase(std::remove_if(pairCache.begin(), pairCache.end(), [this](const ProxyPair& pair) {
+                return proxies[pair.first].dirty || proxies[pair.second].dirty;
+            }), pairCache.end());
+
+            for (uint32_t key : dirty) {
+                const Proxy& proxy = proxies[key];
+                if (proxy.node == DynamicAABBTree::Null) {
+                    continue;
+                }
+                tree.query(tree.getBox(proxy.node), [this, key](int node) {
+                    uint32_t other = tree.getUserData(node);
+                    // Two moved boxes find each other, keep the pair once
+                    if (other != key && (!proxies[other].dirty || key < other)) {
+                        pairCache.emplace_back(std::min(key, other), std::max(key, other));
+                    }
+                    return true;
+                });
+            }
+            for (uint32_t key : dirty) {
+                proxies[key].dirty = false;
+            }
+            dirty.clear();
+        }
+
+        // The fat boxes overlapping doesn't mean the boxes do. Filters are checked here rather than
+        // when caching, since they may change without the box moving.
+        for (const ProxyPair& pair : pairCache) {
+            const Proxy& a = proxies[pair.first];
+            const Proxy& b = proxies[pair.second];
+            if (a.filter.accepts(b.filter) && a.box.overlaps(b.box)) {
+                pairs.push_back(pair);
+            }
+        }
+        frame++;
+    }
+
+    // Calls func(key) for every box overlapping the area, as of the last update
+    template <typename Func>
+    void query(const AABB& area, Func&& func) const {
+        tree.query(area, [&](int node) {
+            uint32_t key = tree.getUserData(node);
+            if (proxies[key].box.overlaps(area)) {
+                func(key);
+            }
+            return true;
+        });
+    }
+
+    // Calls func(key) for every box the segment passes through, as of the last update
+    template <typename Func>
+    void rayCast(const PC::Vector2f& from, const PC::Vector2f& to, Func&& func) const {
+        tree.rayCast(from, to, [&](int node) {
+            uint32_t key = tree.getUserData(node);
+            if (proxies[key].box.intersectsSegment(from, to)) {
+                func(key);
+            }
+            return true;
+        });
+    }
+
+    void clear() {
+        tree.clear();
+        proxies.clear();
+        keys.clear();
+        dirty.clear();
+        pairCache.clear();
+    }
+
+    const DynamicAABBTree& getTree() const {
+        return tree;
+    }
+
+private:
+    struct Proxy {
+        AABB box; // Tight box, the tree holds the fat one
+        ProxyFilter filter;
+        int node = DynamicAABBTree::Null;
+        uint32_t frame = 0;
+        uint32_t listIndex = 0;
+        bool dirty = false;
+    };
+
+    void markDirty(uint32_t key) {
+        if (!proxies[key].dirty) {
+            proxies[key].dirty = true;
+            dirty.push_back(key);
+        }
+    }
+
+    // Takes out the boxes that weren't updated this frame
+    void removeStale() {
+        for (size_t i = 0; i < keys.size();) {
+            uint32_t key = keys[i];
+            Proxy& proxy = proxies[key];
+            if (proxy.frame == frame) {
+                i++;
+                continue;
+            }
+            tree.destroyProxy(proxy.node);
+            proxy.node = DynamicAABBTree::Null;
+            markDirty(key);
+
+            keys[i] = keys.back();
+            proxies[keys[i]].listIndex = static_cast<uint32_t>(i);
+            keys.pop_back();
+        }
+    }
+
+    DynamicAABBTree tree;
+    float margin;
+    uint32_t frame = 1;
+    std::vector<Proxy> proxies; // Indexed by key
+    std::vector<uint32_t> keys; // Keys currently in the tree
+    std::vector<uint32_t> dirty; // Keys inserted, moved or removed since the last findPairs
+    std::vector<ProxyPair> pairCache; // Pairs whose fat boxes overlap
+};
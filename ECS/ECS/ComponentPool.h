@@ -0,0 +1,206 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
+#include "EntityRegistry.h"
+
+// Where a component type is stored. Table components live in archetype chunks next to the other
+// components of the entity; SparseSet components get a pool of their own, which makes adding and
+// removing them cheap and lets systems walk every instance in one linear pass.
+enum class ComponentStorage {
+    Table,
+    SparseSet,
+};
+
+// Components opt in to a storage by declaring: static constexpr ComponentStorage storage = ...;
+template <typename T, typename = void>
+struct ComponentStorageOf {
+    static constexpr ComponentStorage value = ComponentStorage::Table;
+};
+
+template <typename T>
+struct ComponentStorageOf<T, std::void_t<decltype(T::storage)>> {
+    static constexpr ComponentStorage value = T::storage;
+};
+
+// Sparse set of entity handles: the sparse array maps an entity's slot index to its position in the
+// dense array, and the dense array lists the handles in the pool contiguously. Alongside each handle
+// the pool keeps the tick at which the component was last added or marked changed.
+class ComponentPoolBase {
+public:
+    virtual ~ComponentPoolBase() {}
+
+    // Ticks are read from the owning world's change counter
+    void setClock(const uint32_t* clock) {
+        this->clock = clock;
+    }
+
+    void markChanged(EntityId entity) {
+        if (contains(entity)) {
+            ticks[sparse[entity.index()]] = currentTick();
+        }
+    }
+
+    uint32_t changedTick(EntityId entity) const {
+        return contains(entity) ? ticks[sparse[entity.index()]] : 0;
+    }
+
+    // Ticks in dense order, parallel to getEntities()
+    const std::vector<uint32_t>& getTicks() const {
+        return ticks;
+    }
+
+    virtual void remove(EntityId entity) = 0;
+    virtual void clear() = 0;
+
+    // Components the allocated pages can hold, occupied or not
+    virtual size_t capacity() const = 0;
+
+    bool contains(EntityId entity) const {
+        uint32_t index = entity.index();
+        return index < sparse.size() && sparse[index] != Tombstone && dense[sparse[index]] == entity;
+    }
+
+    size_t size() const {
+        return dense.size();
+    }
+
+    const std::vector<EntityId>& getEntities() const {
+        return dense;
+    }
+
+protected:
+    static constexpr uint32_t Tombstone = std::numeric_limits<uint32_t>::max();
+
+    uint32_t currentTick() const {
+        return clock ? *clock : 0;
+    }
+
+    std::vector<uint32_t> sparse;
+    std::vector<EntityId> dense;
+    std::vector<uint32_t> ticks;
+    const uint32_t* clock = nullptr;
+};
+
+// Pool of components of one type, packed in the same order as the dense entity array. Components are
+// stored in fixed-size pages, so growing the pool never moves existing components; removing one moves
+// the last component into the hole (swap-and-pop). Add, remove and lookup are all O(1).
+template <typename T>
+class ComponentPool : public ComponentPoolBase {
+public:
+    static constexpr size_t PageSize = 256;
+    static constexpr size_t PageAlignment = std::max<size_t>(64, alignof(T));
+
+    ComponentPool() = default;
+
+    ~ComponentPool() {
+        clear();
+        for (T* page : pages) {
+            ::operator delete(page, std::align_val_t(PageAlignment));
+        }
+    }
+
+    ComponentPool(const ComponentPool&) = delete;
+    ComponentPool& operator=(const ComponentPool&) = delete;
+
+    // Constructs the entity's component, replacing it if the entity already has one
+    template <typename... TArgs>
+    T& emplace(EntityId entity, TArgs&&... args) {
+        if (contains(entity)) {
+            uint32_t index = sparse[entity.index()];
+            T* existing = slot(index);
+            existing->~T();
+            ticks[index] = currentTick();
+            return *new (existing) T(std::forward<TArgs>(args)...);
+        }
+
+        size_t index = dense.size();
+        if (index == pages.size() * PageSize) {
+            pages.push_back(static_cast<T*>(::operator new(sizeof(T) * PageSize, std::align_val_t(PageAlignment))));
+        }
+        T* component = new (slot(index)) T(std::forward<TArgs>(args)...);
+
+        if (entity.index() >= sparse.size()) {
+            sparse.resize(entity.index() + 1, Tombstone);
+        }
+        sparse[entity.index()] = static_cast<uint32_t>(index);
+        dense.push_back(entity);
+        ticks.push_back(currentTick());
+        return *component;
+    }
+
+    void remove(EntityId entity) override {
+        if (!contains(entity)) {
+            return;
+        }
+
+        uint32_t index = sparse[entity.index()];
+        uint32_t last = static_cast<uint32_t>(dense.size() - 1);
+        T* target = slot(index);
+        target->~T();
+
+        if (index != last) {
+            T* source = slot(last);
+            new (target) T(std::move(*source));
+            source->~T();
+            dense[index] = dense[last];
+            ticks[index] = ticks[last];
+            sparse[dense[index].index()] = index;
+        }
+
+        dense.pop_back();
+        ticks.pop_back();
+        sparse[entity.index()] = Tombstone;
+    }
+
+    void clear() override {
+        for (size_t i = 0; i < dense.size(); i++) {
+            slot(i)->~T();
+            sparse[dense[i].index()] = Tombstone;
+        }
+        dense.clear();
+        ticks.clear();
+    }
+
+    size_t capacity() const override {
+        return pages.size() * PageSize;
+    }
+
+    T& get(EntityId entity) {
+        return *slot(sparse[entity.index()]);
+    }
+
+    T* tryGet(EntityId entity) {
+        return contains(entity) ? slot(sparse[entity.index()]) : nullptr;
+    }
+
+    // Returns the component only if it was added or marked changed after the given tick
+    T* tryGetChangedSince(EntityId entity, uint32_t since) {
+        if (!contains(entity)) {
+            return nullptr;
+        }
+        uint32_t index = sparse[entity.index()];
+        return ticks[index] > since ? slot(index) : nullptr;
+    }
+
+    // Calls func(entity, component) for every component in dense order. Components added by func are
+    // visited too, since pages never move when the pool grows.
+    template <typename Func>
+    void each(Func&& func) {
+        for (size_t i = 0; i < dense.size(); i++) {
+            func(dense[i], *slot(i));
+        }
+    }
+
+private:
+    T* slot(size_t index) const {
+        return pages[index / PageSize] + index % PageSize;
+    }
+
+    std::vector<T*> pages;
+};
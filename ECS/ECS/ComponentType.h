@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <atomic>
+#include <bitset>
+#include <type_traits>
+
+using ComponentType = uint32_t;
+
+// Upper bound on the number of component types, so per-type tables can be plain arrays
+constexpr size_t MaxComponentTypes = 64;
+
+// Hands out dense, sequential ids to component types the first time each type is used
+class ComponentFamily {
+public:
+    static ComponentType next() {
+        static std::atomic<ComponentType> counter{ 0 };
+        ComponentType id = counter++;
+        assert(id < MaxComponentTypes && "too many component types, raise MaxComponentTypes");
+        return id;
+    }
+};
+
+// Dense id of a component type, used to index per-type arrays instead of hashing a type_index.
+// Doesn't rely on RTTI, so the engine builds with it disabled.
+template <typename T>
+struct ComponentTypeId {
+    static ComponentType get() {
+        static const ComponentType id = ComponentFamily::next();
+        return id;
+    }
+};
+
+template <typename T>
+struct ComponentTypeId<const T> : ComponentTypeId<T> {};
+
+// One bit per component type. Entities carry the mask of the components they have, and systems the
+// mask of the components they require.
+using ComponentMask = std::bitset<MaxComponentTypes>;
+
+template <typename... Ts>
+ComponentMask componentMaskOf() {
+    ComponentMask mask;
+    (mask.set(ComponentTypeId<Ts>::get()), ...);
+    return mask;
+}
@@ -0,0 +1,162 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "PCM.h"
+#include "EntityRegistry.h"
+
+// A pair of colliders that are touching, kept for as long as they keep touching
+struct Contact {
+    EntityId a, b; // In the order the pair was first reported
+    uint32_t firstFrame = 0; // Frame the pair started touching
+    uint32_t lastFrame = 0; // Last frame the pair was found touching
+    PC::Vector2f mtv; // Separation found in the last frame
+
+    // Accumulated impulses, so an iterative solver can start from last frame's answer
+    float normalImpulse = 0.0f;
+    float tangentImpulse = 0.0f;
+};
+
+// Contacts that persist between steps, in an open-addressing hash map keyed by the two entity
+// handles packed into 64 bits. Pairs found touching during a step are stamped with the step's
+// frame; sweep then works out which contacts began, continued or ended in one pass over the table
+// and drops the ended ones.
+class ContactCache {
+public:
+    ContactCache() {
+        slots.resize(MinCapacity);
+    }
+
+    // Finds or adds the pair's contact and marks it as touching this frame
+    Contact& touch(EntityId a, EntityId b) {
+        uint64_t key = packKey(a, b);
+        size_t slot = findSlot(key);
+        if (slots[slot].key != key) {
+            if ((count + tombstones + 1) * 10 > slots.size() * 7) {
+                rehash(count + 1);
+                slot = findSlot(key);
+            }
+            if (slots[slot].key == Tombstone) {
+                tombstones--;
+            }
+            slots[slot].key = key;
+            slots[slot].contact = Contact();
+            slots[slot].contact.a = a;
+            slots[slot].contact.b = b;
+            slots[slot].contact.firstFrame = frame;
+            count++;
+        }
+        slots[slot].contact.lastFrame = frame;
+        return slots[slot].contact;
+    }
+
+    // The pair's contact, in either order, or nullptr if they aren't touching
+    Contact* find(EntityId a, EntityId b) {
+        uint64_t key = packKey(a, b);
+        size_t slot = findSlot(key);
+        return slots[slot].key == key ? &slots[slot].contact : nullptr;
+    }
+
+    // Ends the frame: calls began(contact) for the contacts first touched this frame,
+    // continued(contact) for the older ones still touching and ended(contact) for the ones that
+    // weren't touched, which are then removed. Calls are made in table order.
+    template <typename Began, typename Continued, typename Ended>
+    void sweep(Began&& began, Continued&& continued, Ended&& ended) {
+        for (Slot& slot : slots) {
+            if (slot.key == Empty || slot.key == Tombstone) {
+                continue;
+            }
+            if (slot.contact.lastFrame == frame) {
+                if (slot.contact.firstFrame == frame) {
+                    began(slot.contact);
+                }
+                else {
+                    continued(slot.contact);
+                }
+            }
+            else {
+                ended(slot.contact);
+                slot.key = Tombstone;
+                count--;
+                tombstones++;
+            }
+        }
+        frame++;
+    }
+
+    // Calls func(contact) for every contact, in table order
+    template <typename Func>
+    void each(Func&& func) const {
+        for (const Slot& slot : slots) {
+            if (slot.key != Empty && slot.key != Tombstone) {
+                func(slot.contact);
+            }
+        }
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    void clear() {
+        slots.assign(MinCapacity, Slot());
+        count = 0;
+        tombstones = 0;
+    }
+
+private:
+    static constexpr uint64_t Empty = ~uint64_t(0);
+    static constexpr uint64_t Tombstone = ~uint64_t(0) - 1;
+    static constexpr size_t MinCapacity = 64;
+
+    struct Slot {
+        uint64_t key = Empty;
+        Contact contact;
+    };
+
+    // Order independent, so (a, b) and (b, a) are the same contact
+    static uint64_t packKey(EntityId a, EntityId b) {
+        uint32_t low = a.value < b.value ? a.value : b.value;
+        uint32_t high = a.value < b.value ? b.value : a.value;
+        return (static_cast<uint64_t>(high) << 32) | low;
+    }
+
+    // Linear probing. Returns the key's slot, or else the slot to insert it in: the first
+    // tombstone passed, or the empty slot that ended the search.
+    size_t findSlot(uint64_t key) const {
+        size_t mask = slots.size() - 1;
+        size_t slot = static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+        size_t firstTombstone = SIZE_MAX;
+        while (slots[slot].key != Empty) {
+            if (slots[slot].key == key) {
+                return slot;
+            }
+            if (slots[slot].key == Tombstone && firstTombstone == SIZE_MAX) {
+                firstTombstone = slot;
+            }
+            slot = (slot + 1) & mask;
+        }
+        return firstTombstone != SIZE_MAX ? firstTombstone : slot;
+    }
+
+    // Rebuilds the table without tombstones, big enough to stay under half full with the given count
+    void rehash(size_t needed) {
+        size_t capacity = MinCapacity;
+        while (capacity < needed * 2) {
+            capacity <<= 1;
+        }
+        std::vector<Slot> old(capacity);
+        old.swap(slots);
+        tombstones = 0;
+        for (Slot& slot : old) {
+            if (slot.key != Empty && slot.key != Tombstone) {
+                slots[findSlot(slot.key)] = slot;
+            }
+        }
+    }
+
+    std::vector<Slot> slots; // Power of two sized
+    size_t count = 0;
+    size_t tombstones = 0;
+    uint32_t frame = 1;
+};
@@ -0,0 +1,194 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include "PCM.h"
+
+// Tuning of the contact solver
+struct ContactSolverSettings {
+    int velocityIterations = 8;
+    int positionIterations = 3;
+    float slop = 0.5f; // Penetration left in place, so resting contacts keep touching from one frame to the next
+    float correction = 0.4f; // Share of the remaining penetration removed per position iteration
+    float maxCorrection = 8.0f; // Largest push per position iteration
+    float restitutionThreshold = 60.0f; // Closing speeds below this don't bounce
+    bool warmStart = true;
+};
+
+// Sequential impulse solver for the contacts of one frame. Bodies and contacts are kept as
+// structures of arrays. Velocities are solved first: each contact's normal impulse stops the
+// bodies closing (or bounces them apart, with restitution) and its friction impulse is bounded by
+// the normal one. Iterating over all contacts several times lets the impulses spread through
+// stacks. Overlap is then removed by moving the bodies directly, so the position fix adds no energy.
+//
+// Bodies are points with linear velocity only; the engine has no angular motion. Impulses are
+// scalars along the contact normal and its perpendicular, which stay valid when a pair comes back
+// in the other order, so they can be carried over to the next frame to warm start it.
+class ContactSolver {
+public:
+    void clear() {
+        velocityX.clear();
+        velocityY.clear();
+        inverseMass.clear();
+        shiftX.clear();
+        shiftY.clear();
+        bodyA.clear();
+        bodyB.clear();
+        normalX.clear();
+        normalY.clear();
+        depth.clear();
+        friction.clear();
+        bounce.clear();
+        normalMass.clear();
+        normalImpulse.clear();
+        tangentImpulse.clear();
+    }
+
+    // Adds a body and returns its index. Static bodies have an inverse mass of zero.
+    uint32_t addBody(const PC::Vector2f& velocity, float bodyInverseMass) {
+        velocityX.push_back(velocity.x);
+        velocityY.push_back(velocity.y);
+        inverseMass.push_back(bodyInverseMass);
+        shiftX.push_back(0.0f);
+        shiftY.push_back(0.0f);
+        return static_cast<uint32_t>(inverseMass.size() - 1);
+    }
+
+    // Adds a contact between two bodies. mtv is the overlap, pointing from a to b; the impulses
+    // are the ones the pair ended the previous frame with.
+    void addContact(uint32_t a, uint32_t b, const PC::Vector2f& mtv, float contactFriction, float restitution,
+        float previousNormalImpulse = 0.0f, float previousTangentImpulse = 0.0f) {
+        float length = std::sqrt(mtv.x * mtv.x + mtv.y * mtv.y);
+        float nx = length > 0.0f ? mtv.x / length : 0.0f;
+        float ny = length > 0.0f ? mtv.y / length : 0.0f;
+        float massSum = inverseMass[a] + inverseMass[b];
+
+        bodyA.push_back(a);
+        bodyB.push_back(b);
+        normalX.push_back(nx);
+        normalY.push_back(ny);
+        depth.push_back(length);
+        friction.push_back(contactFriction);
+        normalMass.push_back(massSum > 0.0f ? 1.0f / massSum : 0.0f);
+
+        // The bounce is decided by the closing speed before any impulse is applied
+        float closing = (velocityX[b] - velocityX[a]) * nx + (velocityY[b] - velocityY[a]) * ny;
+        bounce.push_back(closing < -settings.restitutionThreshold ? -restitution * closing : 0.0f);
+
+        normalImpulse.push_back(settings.warmStart ? previousNormalImpulse : 0.0f);
+        tangentImpulse.push_back(settings.warmStart ? previousTangentImpulse : 0.0f);
+    }
+
+    void solve() {
+        size_t count = bodyA.size();
+        if (settings.warmStart) {
+            for (size_t i = 0; i < count; i++) {
+                applyImpulse(i, normalImpulse[i], tangentImpulse[i]);
+            }
+        }
+        for (int iteration = 0; iteration < settings.velocityIterations; iteration++) {
+            for (size_t i = 0; i < count; i++) {
+                solveVelocity(i);
+            }
+        }
+        for (int iteration = 0; iteration < settings.positionIterations; iteration++) {
+            for (size_t i = 0; i < count; i++) {
+                solvePosition(i);
+            }
+        }
+    }
+
+    PC::Vector2f getVelocity(uint32_t body) const {
+        return PC::Vector2f(velocityX[body], velocityY[body]);
+    }
+
+    // How far the position fix moved the body
+    PC::Vector2f getShift(uint32_t body) const {
+        return PC::Vector2f(shiftX[body], shiftY[body]);
+    }
+
+    float getNormalImpulse(size_t contact) const {
+        return normalImpulse[contact];
+    }
+
+    float getTangentImpulse(size_t contact) const {
+        return tangentImpulse[contact];
+    }
+
+    PC::Vector2f getNormal(size_t contact) const {
+        return PC::Vector2f(normalX[contact], normalY[contact]);
+    }
+
+    size_t getContactCount() const {
+        return bodyA.size();
+    }
+
+    ContactSolverSettings settings;
+
+private:
+    // Normal impulse along (nx, ny), tangent impulse along (-ny, nx); both push b and pull a
+    void applyImpulse(size_t i, float normal, float tangent) {
+        float px = normalX[i] * normal - normalY[i] * tangent;
+        float py = normalY[i] * normal + normalX[i] * tangent;
+        uint32_t a = bodyA[i];
+        uint32_t b = bodyB[i];
+        velocityX[a] -= px * inverseMass[a];
+        velocityY[a] -= py * inverseMass[a];
+        velocityX[b] += px * inverseMass[b];
+        velocityY[b] += py * inverseMass[b];
+    }
+
+    void solveVelocity(size_t i) {
+        uint32_t a = bodyA[i];
+        uint32_t b = bodyB[i];
+        float nx = normalX[i];
+        float ny = normalY[i];
+
+        // Friction first, bounded by last iteration's normal impulse
+        float sliding = (velocityX[b] - velocityX[a]) * -ny + (velocityY[b] - velocityY[a]) * nx;
+        float maxFriction = friction[i] * normalImpulse[i];
+        float tangent = std::clamp(tangentImpulse[i] - sliding * normalMass[i], -maxFriction, maxFriction);
+        applyImpulse(i, 0.0f, tangent - tangentImpulse[i]);
+        tangentImpulse[i] = tangent;
+
+        // The accumulated normal impulse may shrink, but never pulls the bodies together
+        float closing = (velocityX[b] - velocityX[a]) * nx + (velocityY[b] - velocityY[a]) * ny;
+        float normal = std::max(normalImpulse[i] + (bounce[i] - closing) * normalMass[i], 0.0f);
+        applyImpulse(i, normal - normalImpulse[i], 0.0f);
+        normalImpulse[i] = normal;
+    }
+
+    // Pushes the pair apart along the normal by part of what is left of their overlap, shared by
+    // inverse mass
+    void solvePosition(size_t i) {
+        uint32_t a = bodyA[i];
+        uint32_t b = bodyB[i];
+        float nx = normalX[i];
+        float ny = normalY[i];
+        float moved = (shiftX[b] - shiftX[a]) * nx + (shiftY[b] - shiftY[a]) * ny;
+        float remaining = depth[i] - moved - settings.slop;
+        if (remaining <= 0.0f) {
+            return;
+        }
+        float push = std::min(remaining * settings.correction, settings.maxCorrection) * normalMass[i];
+        shiftX[a] -= nx * push * inverseMass[a];
+        shiftY[a] -= ny * push * inverseMass[a];
+        shiftX[b] += nx * push * inverseMass[b];
+        shiftY[b] += ny * push * inverseMass[b];
+    }
+
+    // Bodies
+    std::vector<float> velocityX, velocityY;
+    std::vector<float> inverseMass;
+    std::vector<float> shiftX, shiftY;
+
+    // Contacts
+    std::vector<uint32_t> bodyA, bodyB;
+    std::vector<float> normalX, normalY;
+    std::vector<float> depth;
+    std::vector<float> friction;
+    std::vector<float> bounce; // Separating speed restitution asks for
+    std::vector<float> normalMass;
+    std::vector<float> normalImpulse, tangentImpulse; // Accumulated over the iterations
+};
@@ -3,19 +3,31 @@
 #include <vector>
 #include <unordered_map>
 #include <map>
-#include <typeindex>
 #include <memory>
 #include <functional>
 #include <algorithm>
 #include <limits>
 #include <cmath>  
-#include <set>
 #include <utility>
+#include <tuple>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <cassert>
 #include <SDL.h>
 #include <SDL_image.h>
 #include "PCM.h"
 #include "Camera.h"
 #include "Renderer.h"
+#include "EntityRegistry.h"
+#include "Archetype.h"
+#include "ComponentPool.h"
+#include "SlabAllocator.h"
+#include "Broadphase.h"
+#include "SAT.h"
+#include "ContactCache.h"
+#include "ContactSolver.h"
+#include "PCTP.h"
 
 
 /*
@@ -31,100 +43,667 @@ Particles
 
 using namespace PC;
 
+class World;
 class Entity;
 class Component;
 class System;
+class SystemManager;
+class CommandBuffer;
+template <typename... Ts> class View;
+
+// Memory use of a world's entity storage, see World::getMemoryStats
+struct StorageStats {
+    SlabStats entities; // This world's own pool
+    size_t tableRows = 0;
+    size_t tableCapacity = 0;
+    size_t poolComponents = 0;
+    size_t poolCapacity = 0;
+};
 
-class Entity : public std::enable_shared_from_this<Entity> {
+// Everything one simulation is made of: its entities, their component storage, the systems that run
+// over them and the structural changes waiting to be applied. Entities come out of the world's own
+// slab pools, so worlds share no state, beyond a lock-free serial counter, and several can be kept
+// in memory at once and updated on different threads without contending.
+class World {
+public:
+    World();
+    ~World();
+
+    World(const World&) = delete;
+    World& operator=(const World&) = delete;
+
+    std::shared_ptr<Entity> createEntity();
+
+    // Removes the entity and its components right away, in O(1) apart from one step per system and
+    // per component it has. Handles to it go stale; an Entity object still held through a shared_ptr
+    // stays around as an empty shell.
+    void destroyEntity(EntityId id);
+
+    // Destroys every entity, leaving the systems registered
+    void clear();
+
+    // Resolves a handle, returning nullptr if the entity has been destroyed
+    Entity* getEntity(EntityId id) const {
+        return registry.get(id);
+    }
+
+    const std::vector<std::shared_ptr<Entity>>& getEntities() const {
+        return entities;
+    }
+
+    template <typename T>
+    ComponentPool<T>& getPool() {
+        static_assert(ComponentStorageOf<T>::value == ComponentStorage::SparseSet, "component is stored in archetypes");
+        ComponentType type = ComponentTypeId<T>::get();
+        if (type >= pools.size()) {
+            pools.resize(type + 1);
+        }
+        auto& pool = pools[type];
+        if (!pool) {
+            pool = std::make_unique<ComponentPool<T>>();
+            pool->setClock(&changeTick);
+        }
+        return static_cast<ComponentPool<T>&>(*pool);
+    }
+
+    // Iterates every entity that has all of the given components. Changed<T> filters count changes
+    // made after the tick given as since.
+    template <typename... Ts>
+    View<Ts...> view(uint32_t since = 0);
+
+    // Pool components are stamped with this tick when they are added or marked changed
+    uint32_t getChangeTick() const {
+        return changeTick;
+    }
+
+    // Moves on to the next tick and returns the one that just ended. A system remembers the value
+    // from its last run and asks for changes after it on the next one.
+    uint32_t advanceChangeTick() {
+        return changeTick++;
+    }
+
+    ArchetypeStorage& getStorage() {
+        return storage;
+    }
+
+    SystemManager& getSystemManager() {
+        return *systemManager;
+    }
+
+    // The calling thread's command buffer for this world
+    CommandBuffer& commands();
+
+    // Sync point: applies what every thread recorded. Must be called while no thread is recording.
+    void playbackCommands();
+
+    // Drops every pending command, e.g. when the scene they were recorded for unloads
+    void discardCommands();
+
+    StorageStats getMemoryStats();
+
+private:
+    friend class Entity;
+    template <typename...> friend class View;
+
+    EntityRegistry registry;
+    ArchetypeStorage storage;
+    std::vector<std::unique_ptr<ComponentPoolBase>> pools; // indexed by ComponentTypeId
+    std::shared_ptr<SlabPoolSet> slabs = std::make_shared<SlabPoolSet>();
+    std::vector<std::shared_ptr<Entity>> entities;
+    std::unique_ptr<SystemManager> systemManager;
+    uint32_t changeTick = 1;
+
+    // Never reused, so a thread's cached command buffer can't be mistaken for one of a later world
+    // that happens to get the same address
+    static inline std::atomic<uint64_t> nextSerial{ 1 };
+    const uint64_t serial = nextSerial++;
+
+    std::mutex commandsMutex; // Only taken to find or add a thread's buffer
+    std::vector<std::pair<std::thread::id, std::unique_ptr<CommandBuffer>>> commandBuffers;
+};
+
+class Entity {
 public:
     std::string name = "";
 
 private:
-    inline static std::vector<std::shared_ptr<Entity>> allEntities = {};
-    std::unordered_map<std::type_index, std::shared_ptr<Component>> components;
+    World* world; // Reset once the entity has been destroyed
+    EntityId id;
+    ComponentMask mask;
+    size_t listIndex = 0; // Position in the world's entity list, for O(1) removal
+
+    // Location of this entity's table components in the archetype storage
+    Archetype* archetype = nullptr;
+    size_t row = 0;
+
+    explicit Entity(World& world) : world(&world), id(world.registry.create(this)) {}
 
-    Entity() {}
+    friend class World;
+    template <typename...> friend class View;
 
 public:
+    Entity(const Entity&) = delete;
+    Entity& operator=(const Entity&) = delete;
+
+    ~Entity() {
+        release();
+    }
+
+    // Components live in the archetype storage or in their pool, which move them around as entities
+    // gain and lose components. The returned pointer is only good until the next structural change
+    // anywhere in the world; keep the entity's id and look the component up again later.
     template <typename T, typename... TArgs>
-    std::shared_ptr<T> addComponent(TArgs&&... args) {
-        auto comp = std::make_shared<T>(std::forward<TArgs>(args)...);
-        comp->owner = this->shared_from_this(); // Set the owner of the component to this entity
-        components[std::type_index(typeid(T))] = comp;
+    T* addComponent(TArgs&&... args) {
+        assert(world && "entity has been destroyed");
+        T* comp;
+        if constexpr (ComponentStorageOf<T>::value == ComponentStorage::SparseSet) {
+            comp = &world->getPool<T>().emplace(id, std::forward<TArgs>(args)...);
+        }
+        else {
+            comp = emplaceInArchetype<T>(std::forward<TArgs>(args)...);
+        }
+        comp->owner = id; // Set the owner of the component to this entity
+        comp->world = world;
+
+        ComponentType type = ComponentTypeId<T>::get();
+        if (!mask.test(type)) {
+            ComponentMask oldMask = mask;
+            mask.set(type);
+            maskChanged(oldMask);
+        }
         return comp;
     }
 
+    template <typename T>
+    void removeComponent() {
+        ComponentType type = ComponentTypeId<T>::get();
+        if (!mask.test(type)) {
+            return;
+        }
+
+        // Systems hear about it first, so they can still look at the component
+        ComponentMask oldMask = mask;
+        mask.reset(type);
+        maskChanged(oldMask);
+
+        if constexpr (ComponentStorageOf<T>::value == ComponentStorage::SparseSet) {
+            world->getPool<T>().remove(id);
+        }
+        else {
+            removeFromArchetype<T>();
+        }
+    }
+
+    // Same lifetime as the pointer addComponent returns
     template<typename T>
-    std::shared_ptr<T> getComponent() {
-        auto iter = components.find(typeid(T));
-        if (iter != components.end()) {
-            return std::dynamic_pointer_cast<T>(iter->second);
+    T* getComponent() {
+        T* comp = nullptr;
+        if constexpr (ComponentStorageOf<T>::value == ComponentStorage::SparseSet) {
+            if (world) {
+                comp = world->getPool<T>().tryGet(id);
+            }
         }
-        return nullptr;
+        else if (archetype) {
+            int column = archetype->columnOf(ComponentTypeId<T>::get());
+            if (column >= 0) {
+                comp = static_cast<T*>(archetype->get(column, row));
+            }
+        }
+        return comp;
+    }
+
+    EntityId getId() const {
+        return id;
+    }
+
+    const ComponentMask& getMask() const {
+        return mask;
     }
 
-    static std::vector<std::shared_ptr<Entity>>& getAllEntities() {
-        std::cout << allEntities.size() << std::endl;
-        return allEntities;
+    World* getWorld() const {
+        return world;
     }
 
-    static std::shared_ptr<Entity> create() {
-        std::shared_ptr<Entity> entity(new Entity());
-        allEntities.push_back(entity);
-        return entity;
+private:
+    void release();
+
+    // Keeps system membership in step with the mask, in O(systems)
+    void maskChanged(const ComponentMask& oldMask);
+
+    template <typename T, typename... TArgs>
+    T* emplaceInArchetype(TArgs&&... args) {
+        ComponentType type = ComponentTypeId<T>::get();
+        int column = archetype ? archetype->columnOf(type) : -1;
+        if (column >= 0) {
+            // Replace the existing component in place
+            T* comp = static_cast<T*>(archetype->get(column, row));
+            comp->~T();
+            return new (comp) T(std::forward<TArgs>(args)...);
+        }
+
+        // Move the entity to the archetype that also has T
+        Archetype* target = world->storage.withComponent<T>(archetype);
+        size_t targetRow = target->pushRow(this);
+        T* comp = new (target->get(target->columnOf(type), targetRow)) T(std::forward<TArgs>(args)...);
+        if (archetype) {
+            Entity* moved = archetype->moveRowTo(row, *target, targetRow);
+            if (moved) {
+                moved->row = row;
+            }
+        }
+        archetype = target;
+        row = targetRow;
+        return comp;
     }
 
-    static void destroyAllEntities() {
-        allEntities.clear();
+    template <typename T>
+    void removeFromArchetype() {
+        // Move the entity to the archetype without T; moving drops the columns the target lacks
+        Archetype* target = world->storage.withoutComponent<T>(archetype);
+        Entity* moved;
+        size_t targetRow = 0;
+        if (target) {
+            targetRow = target->pushRow(this);
+            moved = archetype->moveRowTo(row, *target, targetRow);
+        }
+        else {
+            moved = archetype->removeRow(row);
+        }
+        if (moved) {
+            moved->row = row;
+        }
+        archetype = target;
+        row = targetRow;
     }
 };
 
+// View filter: matches entities whose T was added or marked changed after the view's tick, and
+// hands out T itself. Only sparse-set components keep change ticks.
+template <typename T>
+struct Changed {};
+
+// View filter: hands out a T* that is null for entities without T, instead of skipping them
+template <typename T>
+struct Optional {};
+
+// View filter: skips entities that have T. Nothing is handed out for it.
+template <typename T>
+struct Without {};
+
+template <typename Q>
+struct QueryTerm {
+    using Component = Q;
+    static constexpr bool changed = false;
+    static constexpr bool optional = false;
+    static constexpr bool excluded = false;
+};
+
+template <typename T>
+struct QueryTerm<Changed<T>> : QueryTerm<T> {
+    static constexpr bool changed = true;
+};
+
+template <typename T>
+struct QueryTerm<Optional<T>> : QueryTerm<T> {
+    static constexpr bool optional = true;
+};
+
+template <typename T>
+struct QueryTerm<Without<T>> : QueryTerm<T> {
+    static constexpr bool excluded = true;
+};
+
+// Query over every entity that has all of Ts. Iteration is driven by whichever source is smaller:
+// the smallest sparse-set pool among the required Ts, or the archetypes holding all of the required
+// table components. Optional and Without table components are settled per archetype. The components
+// are handed to func directly, so there is no per-entity getComponent.
+template <typename... Ts>
+class View {
+    static_assert(sizeof...(Ts) > 0, "a view needs at least one component type");
+
+    template <typename Q>
+    using ComponentOf = typename QueryTerm<Q>::Component;
+
+    template <typename Q>
+    static constexpr bool isChanged = QueryTerm<Q>::changed;
+
+    // Entities must have it, as opposed to Optional and Without terms
+    template <typename Q>
+    static constexpr bool isRequired = !QueryTerm<Q>::optional && !QueryTerm<Q>::excluded;
+
+    template <typename Q>
+    static constexpr bool isPooled = ComponentStorageOf<std::remove_const_t<ComponentOf<Q>>>::value == ComponentStorage::SparseSet;
+
+    template <typename Q>
+    using PoolOf = std::conditional_t<isPooled<Q>, ComponentPool<std::remove_const_t<ComponentOf<Q>>>, void>;
+
+    static constexpr bool hasPooled = ((isPooled<Ts> && isRequired<Ts>) || ...);
+    static constexpr bool hasTable = ((!isPooled<Ts> && isRequired<Ts>) || ...);
+    static constexpr bool readsTable = (!isPooled<Ts> || ...);
+
+    static_assert(hasPooled || hasTable, "a view needs at least one required component");
+    static_assert(((!isChanged<Ts> || isPooled<Ts>) && ...), "only sparse-set components track changes");
+
+public:
+    View(World& world, uint32_t since = 0) : world(world), since(since), pools(poolOf<Ts>(world)...) {}
+
+    // Calls func(components...) or func(EntityId, components...) for each matching entity, with a
+    // reference per required term and a pointer per Optional one. Components must not be added to or
+    // removed from the visited entities inside func.
+    template <typename Func>
+    void each(Func&& func) {
+        Driver driver;
+        if constexpr (hasPooled) {
+            size_t smallest = std::numeric_limits<size_t>::max();
+            selectDriver(driver, smallest, std::index_sequence_for<Ts...>{});
+            if constexpr (hasTable) {
+                if (tableRows() <= smallest) {
+                    driver = Driver();
+                }
+            }
+        }
+
+        if (driver.entities) {
+            eachFromPool(driver, func, std::index_sequence_for<Ts...>{});
+        }
+        else {
+            world.storage.eachArchetype<>([&](Archetype& archetype) {
+                if (matches(archetype)) {
+                    eachFromArchetype(archetype, func, std::index_sequence_for<Ts...>{});
+                }
+            });
+        }
+    }
+
+private:
+    // Dense entity list to drive iteration from, plus its ticks when it is a Changed<T> pool so
+    // unchanged entries can be skipped before any lookup
+    struct Driver {
+        const std::vector<EntityId>* entities = nullptr;
+        const std::vector<uint32_t>* ticks = nullptr;
+    };
+
+    template <typename Q>
+    static PoolOf<Q>* poolOf(World& world) {
+        if constexpr (isPooled<Q>) {
+            return &world.getPool<std::remove_const_t<ComponentOf<Q>>>();
+        }
+        else {
+            return nullptr;
+        }
+    }
+
+    template <size_t... Is>
+    void selectDriver(Driver& driver, size_t& smallest, std::index_sequence<Is...>) {
+        (considerPool<Ts>(std::get<Is>(pools), driver, smallest), ...);
+    }
+
+    template <typename Q>
+    static void considerPool(PoolOf<Q>* pool, Driver& driver, size_t& smallest) {
+        if constexpr (isPooled<Q> && isRequired<Q>) {
+            if (pool->size() < smallest) {
+                smallest = pool->size();
+                driver.entities = &pool->getEntities();
+                driver.ticks = isChanged<Q> ? &pool->getTicks() : nullptr;
+            }
+        }
+    }
+
+    static bool matches(const Archetype& archetype) {
+        return (matchesTerm<Ts>(archetype) && ...);
+    }
+
+    template <typename Q>
+    static bool matchesTerm(const Archetype& archetype) {
+        if constexpr (isPooled<Q> || QueryTerm<Q>::optional) {
+            return true;
+        }
+        else {
+            return archetype.has(ComponentTypeId<ComponentOf<Q>>::get()) != QueryTerm<Q>::excluded;
+        }
+    }
+
+    size_t tableRows() {
+        size_t rows = 0;
+        world.storage.eachArchetype<>([&rows](Archetype& archetype) {
+            if (matches(archetype)) {
+                rows += archetype.size();
+            }
+        });
+        return rows;
+    }
+
+    template <typename Func, size_t... Is>
+    void eachFromPool(const Driver& driver, Func& func, std::index_sequence<Is...>) {
+        const std::vector<EntityId>& entities = *driver.entities;
+
+        // Indexed loop, since func may add entities to the driving pool
+        for (size_t i = 0; i < entities.size(); i++) {
+            if (driver.ticks && (*driver.ticks)[i] <= since) {
+                continue;
+            }
+            EntityId id = entities[i];
+            Archetype* archetype = nullptr;
+            size_t row = 0;
+            if constexpr (readsTable) {
+                Entity* entity = world.getEntity(id);
+                if (!entity || (hasTable && !entity->archetype)) {
+                    continue;
+                }
+                archetype = entity->archetype;
+                row = entity->row;
+            }
+            invoke(func, id, fromEntity<Ts>(std::get<Is>(pools), id, archetype, row)...);
+        }
+    }
+
+    template <typename Func, size_t... Is>
+    void eachFromArchetype(Archetype& archetype, Func& func, std::index_sequence<Is...>) {
+        int columns[] = { isPooled<Ts> ? -1 : archetype.columnOf(ComponentTypeId<ComponentOf<Ts>>::get())... };
+        for (size_t chunk = 0; chunk < archetype.chunkCount(); chunk++) {
+            void* bases[] = { columns[Is] >= 0 ? archetype.chunkColumn(chunk, columns[Is]) : nullptr... };
+            Entity** entities = archetype.chunkEntities(chunk);
+            size_t rows = archetype.chunkSize(chunk);
+            for (size_t row = 0; row < rows; row++) {
+                EntityId id = entities[row]->id;
+                invoke(func, id, fromChunk<Ts>(std::get<Is>(pools), id, bases[Is], row)...);
+            }
+        }
+    }
+
+    template <typename Q>
+    ComponentOf<Q>* fromPool(PoolOf<Q>* pool, EntityId id) const {
+        if constexpr (isChanged<Q>) {
+            return pool->tryGetChangedSince(id, since);
+        }
+        else {
+            return pool->tryGet(id);
+        }
+    }
+
+    template <typename Q>
+    ComponentOf<Q>* fromEntity(PoolOf<Q>* pool, EntityId id, Archetype* archetype, size_t row) const {
+        if constexpr (isPooled<Q>) {
+            return fromPool<Q>(pool, id);
+        }
+        else {
+            int column = archetype ? archetype->columnOf(ComponentTypeId<ComponentOf<Q>>::get()) : -1;
+            return column >= 0 ? static_cast<ComponentOf<Q>*>(archetype->get(column, row)) : nullptr;
+        }
+    }
+
+    template <typename Q>
+    ComponentOf<Q>* fromChunk(PoolOf<Q>* pool, EntityId id, void* column, size_t row) const {
+        if constexpr (isPooled<Q>) {
+            return fromPool<Q>(pool, id);
+        }
+        else {
+            return column ? static_cast<ComponentOf<Q>*>(column) + row : nullptr;
+        }
+    }
+
+    // Whether the entity passes the term, given what was found for it
+    template <typename Q>
+    static bool accepts(const ComponentOf<Q>* component) {
+        if constexpr (QueryTerm<Q>::optional) {
+            return true;
+        }
+        else {
+            return (component != nullptr) != QueryTerm<Q>::excluded;
+        }
+    }
+
+    // What func gets for the term: a reference, a pointer for Optional terms, nothing for Without ones
+    template <typename Q>
+    static auto argument(ComponentOf<Q>* component) {
+        if constexpr (QueryTerm<Q>::excluded) {
+            return std::tuple<>();
+        }
+        else if constexpr (QueryTerm<Q>::optional) {
+            return std::tuple<ComponentOf<Q>*>(component);
+        }
+        else {
+            return std::tuple<ComponentOf<Q>&>(*component);
+        }
+    }
+
+    template <typename Func>
+    static void invoke(Func& func, EntityId id, ComponentOf<Ts>*... components) {
+        if (!(accepts<Ts>(components) && ...)) {
+            return;
+        }
+        auto arguments = std::tuple_cat(argument<Ts>(components)...);
+        if constexpr (takesId<Func>(static_cast<decltype(arguments)*>(nullptr))) {
+            std::apply(func, std::tuple_cat(std::tuple<EntityId>(id), arguments));
+        }
+        else {
+            std::apply(func, arguments);
+        }
+    }
+
+    template <typename Func, typename... Args>
+    static constexpr bool takesId(std::tuple<Args...>*) {
+        return std::is_invocable_v<Func&, EntityId, Args...>;
+    }
+
+    World& world;
+    uint32_t since;
+    std::tuple<PoolOf<Ts>*...> pools;
+};
+
+template <typename... Ts>
+View<Ts...> World::view(uint32_t since) {
+    return View<Ts...>(*this, since);
+}
+
 class Component {
 public:
-    std::weak_ptr<Entity> owner; // weak_ptr here to break the cyclic reference
+    EntityId owner; // Plain handle to the owning entity, resolved through the entity registry
+    World* world = nullptr; // World the owning entity lives in
 
     virtual ~Component() {}
 
     Component() = default;
 
+    Entity* getOwner() const {
+        return world ? world->getEntity(owner) : nullptr;
+    }
+
     template <typename T>
-    std::shared_ptr<T> getComponent() const {
-        if (auto sharedOwner = owner.lock()) {
-            return sharedOwner->getComponent<T>();
+    T* getComponent() const {
+        if (Entity* entity = getOwner()) {
+            return entity->getComponent<T>();
         }
         return nullptr;
     }
+
+protected:
+    // Stamps this component with the world's current tick so Changed<T> views pick it up. T is the
+    // concrete, sparse-set stored component type.
+    template <typename T>
+    void markChanged() {
+        if (world) {
+            world->getPool<T>().markChanged(owner);
+        }
+    }
 };
 
 class System {
 public:
-    std::vector<std::weak_ptr<Entity>> entities; // weak_ptr here to ensure we don't unnecessarily keep entities alive
+    std::vector<EntityId> entities; // Plain handles, so iterating them doesn't touch any reference counts
+
+    virtual ~System() {}
 
-    virtual void tryAddEntity(std::shared_ptr<Entity> entity) = 0;
+    // Components an entity needs to be in this system's membership list. Systems that iterate the
+    // component storage directly leave it empty and get no membership list.
+    const ComponentMask& getSignature() const {
+        return signature;
+    }
+
+    virtual void onEntityAdded(EntityId entity) { }
+
+    virtual void onEntityRemoved(EntityId entity) { }
+
+protected:
+    World* world = nullptr; // Set when the system is registered with a world's SystemManager
+
+    template <typename... Ts>
+    void requireComponents() {
+        signature |= componentMaskOf<Ts...>();
+    }
+
+private:
+    friend class SystemManager;
+
+    ComponentMask signature;
+    std::vector<uint32_t> memberIndex; // Position in entities, indexed by entity slot
 };
 
 class SystemManager {
 public:
     std::vector<std::shared_ptr<System>> systems;
 
+    explicit SystemManager(World& world) : world(world) {}
+
     template<typename T, typename... TArgs>
     std::shared_ptr<T> registerSystem(TArgs&&... args) {
         auto t = std::make_shared<T>(std::forward<TArgs>(args)...);
+        t->world = &world;
         systems.emplace_back(t);
+
+        // Pick up the entities that already exist
+        for (auto& entity : world.getEntities()) {
+            if (matches(*t, entity->getMask())) {
+                addToSystem(*t, entity->getId());
+            }
+        }
         return t;
     }
 
-    void addAllEntitiesToSystems(std::vector<std::shared_ptr<Entity>>& allEntities) {
-        for (auto& entity : allEntities) {
-            addEntityToSystems(entity);
+    // Called by an entity whose component mask changed. Only the systems whose signature is
+    // affected by the change do any work.
+    void entityMaskChanged(Entity& entity, const ComponentMask& oldMask) {
+        for (auto& system : systems) {
+            bool had = matches(*system, oldMask);
+            bool has = matches(*system, entity.getMask());
+            if (has && !had) {
+                addToSystem(*system, entity.getId());
+            }
+            else if (had && !has) {
+                removeFromSystem(*system, entity.getId());
+            }
         }
     }
 
-    void resetAllEntities() {
+    void clearEntities() {
         for (auto& system : systems) {
             system->entities.clear();
+            system->memberIndex.clear();
         }
-        Entity::destroyAllEntities();
+    }
+
+    void resetAllEntities() {
+        world.clear();
     }
 
     void resetScene() {
@@ -132,15 +711,287 @@ public:
     }
 
 private:
-    void addEntityToSystems(std::shared_ptr<Entity> entity) {
-        for (auto& system : systems) {
-            system->tryAddEntity(entity);
+    static bool matches(const System& system, const ComponentMask& mask) {
+        const ComponentMask& signature = system.getSignature();
+        return signature.any() && (mask & signature) == signature;
+    }
+
+    static void addToSystem(System& system, EntityId entity) {
+        if (entity.index() >= system.memberIndex.size()) {
+            system.memberIndex.resize(entity.index() + 1);
+        }
+        system.memberIndex[entity.index()] = static_cast<uint32_t>(system.entities.size());
+        system.entities.push_back(entity);
+        system.onEntityAdded(entity);
+    }
+
+    // Swap-and-pop, so membership order is not preserved
+    static void removeFromSystem(System& system, EntityId entity) {
+        if (entity.index() >= system.memberIndex.size()) {
+            return;
+        }
+        uint32_t index = system.memberIndex[entity.index()];
+        if (index >= system.entities.size() || system.entities[index] != entity) {
+            return;
+        }
+        if (index != system.entities.size() - 1) {
+            system.entities[index] = system.entities.back();
+            system.memberIndex[system.entities[index].index()] = index;
+        }
+        system.entities.pop_back();
+        system.onEntityRemoved(entity);
+    }
+
+    World& world;
+};
+
+// Records structural changes (create, destroy, add and remove component) so they can be made while
+// systems are iterating the storage, and applies them later at a sync point. Each thread records
+// into its own buffer, see World::commands().
+class CommandBuffer {
+public:
+    explicit CommandBuffer(World& world) : world(world) {}
+
+    CommandBuffer(const CommandBuffer&) = delete;
+    CommandBuffer& operator=(const CommandBuffer&) = delete;
+
+    // Spawns an entity on playback and hands it to setup to attach its components
+    void create(std::function<void(Entity&)> setup) {
+        record(CommandType::Create, EntityId(), [this, setup = std::move(setup)](Entity*) {
+            std::shared_ptr<Entity> entity = world.createEntity();
+            if (setup) {
+                setup(*entity);
+            }
+        });
+    }
+
+    void destroy(EntityId entity) {
+        record(CommandType::Destroy, entity, [this](Entity* target) {
+            world.destroyEntity(target->getId());
+        });
+    }
+
+    template <typename T, typename... TArgs>
+    void addComponent(EntityId entity, TArgs&&... args) {
+        record(CommandType::AddComponent, entity, [args = std::make_tuple(std::forward<TArgs>(args)...)](Entity* target) mutable {
+            std::apply([target](auto&&... values) { target->addComponent<T>(std::move(values)...); }, std::move(args));
+        });
+    }
+
+    template <typename T>
+    void removeComponent(EntityId entity) {
+        record(CommandType::RemoveComponent, entity, [](Entity* target) {
+            target->removeComponent<T>();
+        });
+    }
+
+    bool empty() const {
+        return commands.empty();
+    }
+
+    void clear() {
+        commands.clear();
+    }
+
+    // Applies the recorded commands grouped by entity, so each entity's storage is visited once,
+    // then creates the new entities in the order they were recorded. Commands on entities that
+    // have been destroyed in the meantime are skipped.
+    void playback() {
+        std::vector<Command> batch;
+        batch.swap(commands); // Commands recorded during playback wait for the next one
+
+        // Creates carry the invalid handle, which sorts after every real one
+        std::stable_sort(batch.begin(), batch.end(), [](const Command& a, const Command& b) {
+            return a.entity < b.entity;
+        });
+
+        for (Command& command : batch) {
+            if (command.type == CommandType::Create) {
+                command.apply(nullptr);
+            }
+            else if (Entity* entity = world.getEntity(command.entity)) {
+                command.apply(entity);
+            }
         }
     }
+
+private:
+    enum class CommandType {
+        Create,
+        AddComponent,
+        RemoveComponent,
+        Destroy,
+    };
+
+    struct Command {
+        CommandType type;
+        EntityId entity;
+        std::function<void(Entity*)> apply;
+    };
+
+    void record(CommandType type, EntityId entity, std::function<void(Entity*)> apply) {
+        commands.push_back({ type, entity, std::move(apply) });
+    }
+
+    World& world;
+    std::vector<Command> commands;
 };
 
+inline World::World() : systemManager(std::make_unique<SystemManager>(*this)) {}
+
+inline World::~World() {
+    clear();
+}
+
+// Entities and their shared_ptr control blocks both come from the world's slab pools, so spawning a
+// wave doesn't hit the general-purpose heap once the pools have warmed up. The deleter and the
+// control block's allocator hold on to the pools, so an entity may outlive its world.
+inline std::shared_ptr<Entity> World::createEntity() {
+    SlabAllocator<Entity> allocator(slabs);
+    Entity* raw = new (allocator.allocate(1)) Entity(*this);
+    std::shared_ptr<Entity> entity(raw, [allocator](Entity* ptr) mutable {
+        ptr->~Entity();
+        allocator.deallocate(ptr, 1);
+    }, allocator);
+    entity->listIndex = entities.size();
+    entities.push_back(entity);
+    return entity;
+}
+
+inline void World::destroyEntity(EntityId id) {
+    Entity* entity = getEntity(id);
+    if (!entity) {
+        return;
+    }
+    size_t index = entity->listIndex;
+    entity->release();
+
+    // Swap-and-pop out of the entity list; this may delete the entity
+    std::shared_ptr<Entity> removed = std::move(entities[index]);
+    if (index != entities.size() - 1) {
+        entities[index] = std::move(entities.back());
+        entities[index]->listIndex = index;
+    }
+    entities.pop_back();
+}
+
+inline void World::clear() {
+    systemManager->clearEntities();
+
+    // Tear the components down even if something else still holds on to an entity
+    for (auto& entity : entities) {
+        registry.destroy(entity->id);
+        entity->id = EntityId();
+        entity->mask.reset();
+        entity->archetype = nullptr;
+        entity->world = nullptr;
+    }
+    storage.clear();
+    for (auto& pool : pools) {
+        if (pool) {
+            pool->clear();
+        }
+    }
+    entities.clear();
+}
+
+// Each thread remembers the last world it recorded into and its buffer there, so recording only
+// takes the lock when a thread switches worlds. Buffers live as long as their world.
+inline CommandBuffer& World::commands() {
+    struct CachedBuffer {
+        uint64_t world = 0;
+        CommandBuffer* buffer = nullptr;
+    };
+    thread_local CachedBuffer cached;
+    if (cached.world == serial) {
+        return *cached.buffer;
+    }
+
+    std::lock_guard<std::mutex> lock(commandsMutex);
+    std::thread::id thread = std::this_thread::get_id();
+    CommandBuffer* found = nullptr;
+    for (auto& [owner, buffer] : commandBuffers) {
+        if (owner == thread) {
+            found = buffer.get();
+            break;
+        }
+    }
+    if (!found) {
+        commandBuffers.emplace_back(thread, std::make_unique<CommandBuffer>(*this));
+        found = commandBuffers.back().second.get();
+    }
+    cached = { serial, found };
+    return *found;
+}
+
+inline void World::playbackCommands() {
+    for (size_t i = 0; i < commandBuffers.size(); i++) {
+        commandBuffers[i].second->playback();
+    }
+}
+
+inline void World::discardCommands() {
+    std::lock_guard<std::mutex> lock(commandsMutex);
+    for (auto& [owner, buffer] : commandBuffers) {
+        buffer->clear();
+    }
+}
+
+inline StorageStats World::getMemoryStats() {
+    StorageStats stats;
+    stats.entities = slabs->pool<Entity>().getStats();
+    storage.eachArchetype<>([&stats](Archetype& archetype) {
+        stats.tableRows += archetype.size();
+        stats.tableCapacity += archetype.reservedRows();
+    });
+    for (auto& pool : pools) {
+        if (pool) {
+            stats.poolComponents += pool->size();
+            stats.poolCapacity += pool->capacity();
+        }
+    }
+    return stats;
+}
+
+inline void Entity::release() {
+    if (!world) {
+        return;
+    }
+
+    ComponentMask oldMask = mask;
+    if (oldMask.any()) {
+        mask.reset();
+        maskChanged(oldMask);
+    }
+    if (archetype) {
+        Entity* moved = archetype->removeRow(row);
+        if (moved) {
+            moved->row = row;
+        }
+        archetype = nullptr;
+    }
+    // Only the pools of components the entity had need to hear about it
+    for (ComponentType type = 0; type < world->pools.size(); type++) {
+        if (oldMask.test(type) && world->pools[type]) {
+            world->pools[type]->remove(id);
+        }
+    }
+    world->registry.destroy(id);
+    id = EntityId();
+    world = nullptr;
+}
+
+inline void Entity::maskChanged(const ComponentMask& oldMask) {
+    world->systemManager->entityMaskChanged(*this, oldMask);
+}
+
+// The local matrix is built lazily: setters only store the value and flag it, so moving an entity
+// several times in a frame costs nothing until something reads the matrix. Matrices are kept as
+// 2x3 affines, the bottom row of a 2D transform being constant.
 class TransformComponent : public Component {
-public:   
+public:
+    static constexpr ComponentStorage storage = ComponentStorage::SparseSet;
+
     TransformComponent(Vector2f position = Vector2f(0.0f, 0.0f),
         float rotation = 0.0f, Vector2f scale = Vector2f(1.0f, 1.0f)) {
         setPosition(position);
@@ -161,11 +1012,23 @@ public:
         return rotation;
     }
 
+    // The sine and cosine are only recomputed here, not on every matrix rebuild
     void setRotation(float rot) {
         rotation = rot;
+        float radians = static_cast<float>(rot * M_PI / 180.0f);
+        rotationCos = std::cos(radians);
+        rotationSin = std::sin(radians);
         updateTransformMatrix();
     }
 
+    float getRotationCos() const {
+        return rotationCos;
+    }
+
+    float getRotationSin() const {
+        return rotationSin;
+    }
+
     Vector2f getScale() {
         return scale;
     }
@@ -175,38 +1038,109 @@ public:
         updateTransformMatrix();
     }
 
+    const Affine2Df& getLocalAffine() {
+        if (localDirty) {
+            localMatrix = Affine2Df::fromTRS(position, rotationCos, rotationSin, scale);
+            localDirty = false;
+        }
+        return localMatrix;
+    }
+
     Matrix3x3<float> getTransformMatrix() {
-        return transformMatrix;
+        return getLocalAffine().toMatrix3x3();
     }
 
+    // Flags the local matrix for a rebuild on the next read
     void updateTransformMatrix() {
-        transformMatrix = Matrix3x3<float>::Matrix3x3FromTranslation(position) *
-            Matrix3x3<float>::Matrix3x3FromRotation(rotation) *
-            Matrix3x3<float>::Matrix3x3FromScale(scale);
+        localDirty = true;
+        markChanged<TransformComponent>();
     }
 
-    void setWorldSpaceMatrix(const Matrix3x3<float>& matrix) {
-        worldSpaceMatrix = matrix;
+    // Local matrix composed with every parent's, i.e. the transform relative to the scene root.
+    // Kept up to date by the WorldSpaceSystem; equal to the local matrix for unparented entities.
+    // The camera is left out, so it only changes when the transform or one of its parents does.
+    const Affine2Df& getGlobalAffine() const {
+        return globalMatrix;
     }
 
-    Matrix3x3<float> getWorldSpaceMatrix() {
-        return worldSpaceMatrix;
+    void setGlobalAffine(const Affine2Df& matrix) {
+        globalMatrix = matrix;
+        previousGlobalMatrix = matrix;
+        globalRun = 0;
+        stampGlobal();
     }
 
-    Vector2f getWorldSpacePosition() {
-        return worldSpaceMatrix.getTranslation();
+    // Sets the global matrix for a WorldSpaceSystem run, keeping the one it replaces unless that
+    // was set in the same run. A fresh transform has nothing to blend from.
+    void updateGlobalAffine(const Affine2Df& matrix, uint32_t run) {
+        if (run != globalRun) {
+            previousGlobalMatrix = globalRun ? globalMatrix : matrix;
+            globalRun = run;
+        }
+        globalMatrix = matrix;
+        stampGlobal();
+    }
+
+    // Between the last two global matrices, alpha 0 being the older one. Transforms not recomputed
+    // in the given run haven't moved since the one before it, so they give the current one.
+    Affine2Df getInterpolatedGlobalAffine(float alpha, uint32_t run) const {
+        return run == globalRun ? Affine2Df::lerp(previousGlobalMatrix, globalMatrix, alpha) : globalMatrix;
+    }
+
+    // Change tick the global matrix was last written on. Anything built from the matrix only needs
+    // rebuilding once this moves on from the tick it was built at.
+    uint32_t getGlobalTick() const {
+        return globalTick;
     }
 
-    float getWorldSpaceRotation() {
-        return worldSpaceMatrix.getRotation();
+    Matrix3x3<float> getGlobalMatrix() {
+        return globalMatrix.toMatrix3x3();
+    }
+
+    // The global matrix seen through the given camera matrix, i.e. in screen space
+    Affine2Df getWorldSpaceAffine(const Affine2Df& camera) const {
+        return camera * globalMatrix;
     }
 
 private:
     Vector2f position;
-    float rotation;
+    float rotation = 0.0f;
+    float rotationCos = 1.0f;
+    float rotationSin = 0.0f;
     Vector2f scale;
-    Matrix3x3<float> transformMatrix;
-    Matrix3x3<float> worldSpaceMatrix;
+    bool localDirty = true;
+    Affine2Df localMatrix;
+    Affine2Df globalMatrix;
+    Affine2Df previousGlobalMatrix;
+    uint32_t globalRun = 0; // WorldSpaceSystem run that last set the matrix
+    uint32_t globalTick = 0;
+
+    void stampGlobal() {
+        if (world) {
+            globalTick = world->getChangeTick();
+        }
+    }
+};
+
+// Attaches an entity to a parent, so its transform is relative to the parent's. The parent is held
+// by handle; once it is destroyed the child behaves like a root again.
+class HierarchyComponent : public Component {
+public:
+    static constexpr ComponentStorage storage = ComponentStorage::SparseSet;
+
+    HierarchyComponent(EntityId parent = EntityId()) : parent(parent) {}
+
+    EntityId getParent() const {
+        return parent;
+    }
+
+    void setParent(EntityId newParent) {
+        parent = newParent;
+        markChanged<HierarchyComponent>();
+    }
+
+private:
+    EntityId parent;
 };
 
 class AnimationState {
@@ -380,6 +1314,17 @@ public:
         srcRect = frames[0];
     }
 
+    // Components are moved around by the archetype storage, so ownership of the texture and
+    // sprite handler has to travel with them
+    SpriteComponent(SpriteComponent&& other) noexcept
+        : Component(std::move(other)), spriteSheet(std::exchange(other.spriteSheet, nullptr)),
+        frames(std::move(other.frames)), srcRect(other.srcRect), startingFrame(other.startingFrame),
+        currentFrame(other.currentFrame), frameCount(other.frameCount), lastFrameTime(other.lastFrameTime),
+        flip(other.flip), animationStates(std::move(other.animationStates)), currentState(std::move(other.currentState)),
+        animationPlaying(other.animationPlaying), frameTime(other.frameTime), elapsedTime(other.elapsedTime),
+        spriteHandler(std::exchange(other.spriteHandler, nullptr)) {
+    }
+
     ~SpriteComponent() {
         if (spriteSheet) {
             SDL_DestroyTexture(spriteSheet);
@@ -436,10 +1381,8 @@ public:
         }
     }
 
-    SDL_Rect getWorldSpaceRect() {
-        auto transform = owner.lock()->getComponent<TransformComponent>();
-        Matrix3x3f m = transform->getWorldSpaceMatrix();
-
+    // Destination rectangle for the given world space matrix
+    SDL_Rect getWorldSpaceRect(const Affine2Df& m) {
         Vector2f pos = m.getTranslation();
         Vector2f scale = m.getScale();
 
@@ -507,14 +1450,19 @@ public:
         SDL_SetRenderTarget(renderer, NULL);
     }
 
-    ~SquareComponent() {
-        SDL_DestroyTexture(texture);
+    SquareComponent(SquareComponent&& other) noexcept
+        : Component(std::move(other)), rect(other.rect), color(other.color),
+        texture(std::exchange(other.texture, nullptr)) {
     }
 
-    SDL_Rect getWorldSpaceRect() {
-        auto transform = owner.lock()->getComponent<TransformComponent>();
-        Matrix3x3f m = transform->getWorldSpaceMatrix();
+    ~SquareComponent() {
+        if (texture) {
+            SDL_DestroyTexture(texture);
+        }
+    }
 
+    // Destination rectangle for the given world space matrix
+    SDL_Rect getWorldSpaceRect(const Affine2Df& m) {
         Vector2f pos = m.getTranslation();
         Vector2f scale = m.getScale();
 
@@ -528,60 +1476,8 @@ public:
     }
 };
 
-struct OBB {
-    Vector2f center;
-    Vector2f extents;
-    Matrix3x3f rotationMatrix;
-
-    OBB() = default;
-    OBB(const Vector2f& center, const Vector2f& extents, const Matrix3x3f& rotationMatrix)
-        : center(center), extents(extents), rotationMatrix(rotationMatrix) { }
-
-    void projectOntoAxis(const Vector2f& axis, float& min, float& max) const {
-        Vector2f vertices[4] = {
-            center + (rotationMatrix * (extents * Vector2f(1, 1))),
-            center + (rotationMatrix * (extents * Vector2f(1, -1))),
-            center + (rotationMatrix * (extents * Vector2f(-1, -1))),
-            center + (rotationMatrix * (extents * Vector2f(-1, 1)))
-        };
-
-        min = max = axis.dotProduct(vertices[0]);
-
-        for (int i = 1; i < 4; i++) {
-            float projection = axis.dotProduct(vertices[i]);
-
-            if (projection < min) min = projection;
-            else if (projection > max) max = projection;
-        }
-    }
-
-    std::vector<Vector2f> getAxes() const {
-        // Retrieve the corners (vertices) of the OBB
-        Vector2f vertices[4] = {
-            center + (rotationMatrix * (extents * Vector2f(1, 1))),
-            center + (rotationMatrix * (extents * Vector2f(1, -1))),
-            center + (rotationMatrix * (extents * Vector2f(-1, -1))),
-            center + (rotationMatrix * (extents * Vector2f(-1, 1)))
-        };
-
-        // Compute the edge vectors from the vertices
-        Vector2f edges[2] = {
-            vertices[1] - vertices[0],  // Edge from vertex 0 to 1
-            vertices[3] - vertices[0]   // Edge from vertex 0 to 3
-        };
-
-        // Find normals (axes) to the edge vectors
-        std::vector<Vector2f> axes;
-        for (int i = 0; i < 2; i++) {
-            Vector2f normal(-edges[i].y, edges[i].x);
-            axes.push_back(normal.normalize());
-        }
-
-        return axes;
-    }
-
-};
-
+// Named layers for the common case of one category per collider. Any of the 32 category bits can
+// be used, see BoxColliderComponent::setCategoryBits.
 enum CollisionLayer {
     Default = 0,
     LayerOne,
@@ -596,30 +1492,49 @@ enum CollisionLayer {
     LastLayer,
 };
 
+using CollisionBits = uint32_t;
+
+constexpr int MaxCollisionLayers = 32;
+constexpr CollisionBits AllCollisionBits = ~CollisionBits(0);
+
+inline constexpr CollisionBits layerBit(int layer) {
+    return CollisionBits(1) << layer;
+}
+
+// Which layers collide with which, one bit row per layer
 class CollisionMatrix {
 public:
     CollisionMatrix() {
         // By default, all layers collide with each other
-        for (int i = 0; i < LastLayer; i++) {
-            for (int j = 0; j < LastLayer; j++) {
-                matrix[i][j] = true;
-            }
+        for (int i = 0; i < MaxCollisionLayers; i++) {
+            masks[i] = AllCollisionBits;
         }
     }
 
     // Set if two layers should collide
     void setShouldCollide(CollisionLayer layer1, CollisionLayer layer2, bool shouldCollide) {
-        matrix[layer1][layer2] = shouldCollide;
-        matrix[layer2][layer1] = shouldCollide; // Ensure symmetry
+        if (shouldCollide) {
+            masks[layer1] |= layerBit(layer2);
+            masks[layer2] |= layerBit(layer1); // Ensure symmetry
+        }
+        else {
+            masks[layer1] &= ~layerBit(layer2);
+            masks[layer2] &= ~layerBit(layer1);
+        }
     }
 
     // Check if two layers should collide
     bool shouldCollide(CollisionLayer layer1, CollisionLayer layer2) const {
-        return matrix[layer1][layer2];
+        return (masks[layer1] & layerBit(layer2)) != 0;
+    }
+
+    // The layers the given layer collides with
+    CollisionBits getMask(CollisionLayer layer) const {
+        return masks[layer];
     }
 
 private:
-    bool matrix[LastLayer][LastLayer];
+    CollisionBits masks[MaxCollisionLayers];
 };
 
 class BoxColliderComponent : public Component {
@@ -630,14 +1545,12 @@ public:
         : rect(rect), customCollider(true) { }
 
 
-    SDL_Rect getWorldSpaceRect() {
-        auto sprite = owner.lock()->getComponent<SpriteComponent>();
-        auto square = owner.lock()->getComponent<SquareComponent>();
+    // The collider's rectangle under the owner's world space matrix
+    SDL_Rect getWorldSpaceRect(const Affine2Df& m) {
+        auto sprite = getComponent<SpriteComponent>();
+        auto square = getComponent<SquareComponent>();
 
         if (customCollider) {            
-            auto transform = owner.lock()->getComponent<TransformComponent>();
-            Matrix3x3f m = transform->getWorldSpaceMatrix();
-
             Vector2f pos = m.getTranslation();
             Vector2f scale = m.getScale();
 
@@ -647,43 +1560,94 @@ public:
             return temp;
         }
         else if (sprite) {
-            return sprite->getWorldSpaceRect();
+            return sprite->getWorldSpaceRect(m);
         }
         else if (square) {
-            return square->getWorldSpaceRect();
+            return square->getWorldSpaceRect(m);
         }
 
         return { 0, 0, 0, 0 };
     }
 
-    OBB getWorldSpaceOBB() {
-        SDL_Rect temp = getWorldSpaceRect();
-        auto transform = owner.lock()->getComponent<TransformComponent>();
+    // Size of the box before the transform's scale: the custom rectangle, or else the sprite's
+    // current frame or the square
+    Vector2f getLocalSize() {
+        if (customCollider) {
+            return Vector2f(static_cast<float>(rect.width), static_cast<float>(rect.height));
+        }
+        if (auto sprite = getComponent<SpriteComponent>()) {
+            return Vector2f(static_cast<float>(sprite->srcRect.w), static_cast<float>(sprite->srcRect.h));
+        }
+        if (auto square = getComponent<SquareComponent>()) {
+            return Vector2f(static_cast<float>(square->rect.width), static_cast<float>(square->rect.height));
+        }
+        return Vector2f(0.0f, 0.0f);
+    }
+
+    // Same box as getWorldSpaceRect, but in scene space rather than through the camera, and kept in
+    // floats rather than rounded to whole pixels, so the contact solver sees overlaps smaller than a pixel
+    OBB getGlobalOBB() {
+        return getGlobalOBB(getComponent<TransformComponent>()->getGlobalAffine(), getLocalSize());
+    }
 
-        // Calculate the center of the rectangle
-        Vector2f center(static_cast<float>(temp.x + temp.w / 2), static_cast<float>(temp.y + temp.h / 2));
+    // The box for the given global matrix and local size, see getLocalSize
+    OBB getGlobalOBB(const Affine2Df& m, const Vector2f& localSize) const {
+        Vector2f scale = m.getScale();
+        Vector2f size(localSize.x * scale.x, localSize.y * scale.y);
+        Vector2f center = customCollider ? m * (localSize * 0.5f) : m.getTranslation();
 
-        return OBB(center,
-            Vector2f(static_cast<float>(temp.w) / 2, static_cast<float>(temp.h) / 2),
-            Matrix3x3f::Matrix3x3FromRotation(transform->getRotation()));
+        // The axes are the matrix columns with the scale taken out, so a parent's rotation carries
+        // over to the box. A flat box keeps the unrotated axis.
+        Vector2f axisX = scale.x > 0.0f ? Vector2f(m.a / scale.x, m.c / scale.x) : Vector2f(1.0f, 0.0f);
+        Vector2f axisY = scale.y > 0.0f ? Vector2f(m.b / scale.y, m.d / scale.y) : Vector2f(0.0f, 1.0f);
+        return OBB(center, size * 0.5f,
+            Matrix3x3f({ { axisX.x, axisY.x, 0.0f },
+                { axisX.y, axisY.y, 0.0f },
+                { 0.0f, 0.0f, 1.0f } }));
     }
 
+    // Puts the collider in a single layer, which becomes its only category
     void setLayer(CollisionLayer layer) {
         this->layer = layer;
+        categoryBits = layerBit(layer);
     }
 
     CollisionLayer getLayer() const {
         return layer;
     }
+
+    // What the collider is. Two colliders are tested only if each one's category is in the
+    // other's mask.
+    void setCategoryBits(CollisionBits bits) {
+        categoryBits = bits;
+    }
+
+    CollisionBits getCategoryBits() const {
+        return categoryBits;
+    }
+
+    // What the collider collides with, on top of what the scene's collision matrix allows its layer
+    void setMaskBits(CollisionBits bits) {
+        maskBits = bits;
+    }
+
+    CollisionBits getMaskBits() const {
+        return maskBits;
+    }
+
 private:
     Rectangle rect;
     bool customCollider;
     std::vector<std::function<void(Entity*, Entity*)>> collisionHandlers;
     CollisionLayer layer = Default;
+    CollisionBits categoryBits = layerBit(Default);
+    CollisionBits maskBits = AllCollisionBits;
 };
 
 class PhysicsComponent : public Component {
 public:
+    static constexpr ComponentStorage storage = ComponentStorage::SparseSet;
+
     Vector2f velocity;
     Vector2f acceleration;
     float mass;
@@ -691,8 +1655,22 @@ public:
     float restitution;   // added this
     bool isStatic;
     bool isAffectedByGravity;
-    bool isGrounded;
+    bool isGrounded; // Resting on something, as of the last collision update
     float damping = 0.99f;
+    float friction = 0.2f;
+
+    // A sleeping body is skipped by the integration and by the narrowphase against other resting
+    // bodies until something wakes it: a force, a contact with an awake body or a script moving it
+    bool isSleeping = false;
+    bool canSleep = true;
+    float sleepTime = 0.0f; // Seconds spent below the sleep velocity
+    uint32_t sleepTick = 0; // Change tick the body fell asleep on
+
+    // A fast body has its motion swept against the other colliders each step, so it stops at what
+    // it would otherwise pass through between two steps. Every substep lets it bounce off one more
+    // collider within the same step. Meant for bodies with no parent transform.
+    bool isFast = false;
+    int substeps = 1;
 
     PhysicsComponent(float mass, bool isAffectedByGravity = true, bool isStatic = false, float restitution = 0.5f)
         : mass(mass), restitution(restitution), isAffectedByGravity(isAffectedByGravity), isStatic(isStatic),
@@ -708,12 +1686,24 @@ public:
         }
     }
 
+    // A zero force leaves the body as it is, so scripts can push every frame without keeping it awake
     void applyForce(const Vector2f& force) {
-        if (!isStatic) {
+        if (!isStatic && (force.x != 0.0f || force.y != 0.0f)) {
             acceleration += force / mass;
             isGrounded = false;
+            wake();
         }
     }
+
+    void wake() {
+        isSleeping = false;
+        sleepTime = 0.0f;
+    }
+
+    // Whether the transform was changed by something else while the body slept
+    bool movedWhileAsleep(uint32_t transformTick) const {
+        return isSleeping && transformTick > sleepTick;
+    }
 };
 
 class RenderLayerComponent : public Component {
@@ -725,25 +1715,50 @@ public:
 
 class Script {
 public:
-    std::weak_ptr<Entity> entity; // Using weak_ptr to break cyclic reference
+    EntityId entity; // Plain handle to the entity the script is attached to
+    World* world = nullptr;
+
+    virtual ~Script() {}
 
     virtual void start() { }
 
     virtual void update(float deltaTime) { }
 
-    virtual void onCollision(const std::shared_ptr<Entity>& other) { }
+    // Called once when a contact begins, before the first onCollision
+    virtual void onCollisionEnter(EntityId other) { }
+
+    // Called every frame while touching
+    virtual void onCollision(EntityId other) { }
+
+    virtual void onCollisionExit(EntityId other) { }
+
+    void setEntity(World* world, EntityId id) {
+        this->world = world;
+        this->entity = id;
+    }
+
+    Entity* getEntity() const {
+        return world ? world->getEntity(entity) : nullptr;
+    }
 
-    virtual void onCollisionExit(const std::shared_ptr<Entity>& other) { }
+    World* getWorld() const {
+        return world;
+    }
 
-    void setEntity(const std::shared_ptr<Entity>& entityPtr) {
-        this->entity = entityPtr;
+    // Looks the component up on every call, since scripts outlive any pointer into the storage
+    template <typename T>
+    T* getComponent() const {
+        Entity* owner = getEntity();
+        return owner ? owner->getComponent<T>() : nullptr;
     }
 };
 
 class ScriptComponent : public Component {
 public:
+    static constexpr ComponentStorage storage = ComponentStorage::SparseSet;
+
     void addScript(std::shared_ptr<Script> script) {
-        script->setEntity(owner.lock()); // Convert weak_ptr to shared_ptr
+        script->setEntity(world, owner);
         scripts.push_back(script);
     }
 
@@ -759,13 +1774,19 @@ public:
         }
     }
 
-    void onCollision(const std::shared_ptr<Entity>& other) {
+    void onCollisionEnter(EntityId other) {
+        for (auto& script : scripts) {
+            script->onCollisionEnter(other);
+        }
+    }
+
+    void onCollision(EntityId other) {
         for (auto& script : scripts) {
             script->onCollision(other);
         }
     }
 
-    void onCollisionExit(const std::shared_ptr<Entity>& other) {
+    void onCollisionExit(EntityId other) {
         for (auto& script : scripts) {
             script->onCollisionExit(other);
         }
@@ -777,7 +1798,6 @@ private:
 class RenderSystem : public System {
 public:
     SDL_Renderer* renderer;
-    std::map<int, std::vector<std::shared_ptr<Entity>>> renderLayers;
 
     RenderSystem(bool showColliders = false, int ssaaFactor = 2) :
         renderer(Renderer::Instance().Get()),
@@ -802,52 +1822,45 @@ public:
         SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
         SDL_RenderClear(renderer);
 
+        buildDrawList();
 
-        for (auto& layer : renderLayers) {
-            for (const auto& entity : layer.second) {
-                auto transform = entity->getComponent<TransformComponent>();
-                auto sprite = entity->getComponent<SpriteComponent>();
-                auto shape = entity->getComponent<SquareComponent>();
-                if (sprite) {
-                    SDL_Rect temp = sprite->getWorldSpaceRect();
-
-                    float rot = transform->getWorldSpaceRotation();
-
-                    SDL_RenderCopyEx(renderer, sprite->spriteSheet, &(sprite->srcRect), &temp,
-                        transform->getRotation(), nullptr, sprite->flip);
-                    sprite->nextFrame(deltaTime);
-                #ifdef _DEBUG
-                    auto boxCollider = entity->getComponent<BoxColliderComponent>();
-                    if (boxCollider && showColliders) {
-                        SDL_SetRenderDrawColor(renderer, 173, 216, 230, 255);  // Light blue
+        // Transforms only hold scene space matrices; the camera goes on here, for everything drawn at once
+        worldSpaces.resize(drawList.size());
+        for (size_t i = 0; i < drawList.size(); i++) {
+            worldSpaces.set(i, drawList[i].transform->getInterpolatedGlobalAffine(interpolation, interpolationRun));
+        }
+        Batch::multiplyAffines(camera, worldSpaces.arrays(), worldSpaces.arrays(), worldSpaces.size());
+
+        for (size_t i = 0; i < drawList.size(); i++) {
+            DrawCommand& command = drawList[i];
+            Affine2Df worldSpace = worldSpaces.get(i);
+            float rot = worldSpace.getRotation();
+            if (SpriteComponent* sprite = command.sprite) {
+                SDL_Rect temp = sprite->getWorldSpaceRect(worldSpace);
+
+                SDL_RenderCopyEx(renderer, sprite->spriteSheet, &(sprite->srcRect), &temp,
+                    rot, nullptr, sprite->flip);
+                sprite->nextFrame(deltaTime);
+            }
+            else {
+                SquareComponent* shape = command.shape;
+                SDL_Rect temp = shape->getWorldSpaceRect(worldSpace);
 
-                        SDL_Point points[5];
-                        computeRotatedBox(boxCollider, rot, points);
-                        SDL_RenderDrawLines(renderer, points, 5);                
-                    }
-                #endif
-                }
-                else if (shape) {
-                    SDL_Rect temp = shape->getWorldSpaceRect();
-                    float rot = transform->getWorldSpaceRotation();
-
-                    SDL_RenderCopyEx(renderer, shape->texture, NULL, &temp, rot, NULL,
-                        SDL_FLIP_NONE);
-                #ifdef _DEBUG
-                    auto boxCollider = 
-                        entity->getComponent<BoxColliderComponent>();
-
-                    if (boxCollider && showColliders) {
-                        SDL_SetRenderDrawColor(renderer, 173, 216, 230, 255);  // Light blue
-
-                        SDL_Point points[5];
-                        computeRotatedBox(boxCollider, rot, points);
-                        SDL_RenderDrawLines(renderer, points, 5);
-                    }
-                #endif                
+                SDL_RenderCopyEx(renderer, shape->texture, NULL, &temp, rot, NULL,
+                    SDL_FLIP_NONE);
+            }
+        #ifdef _DEBUG
+            if (showColliders) {
+                auto boxCollider = world->getEntity(command.entity)->getComponent<BoxColliderComponent>();
+                if (boxCollider) {
+                    SDL_SetRenderDrawColor(renderer, 173, 216, 230, 255);  // Light blue
+
+                    SDL_Point points[5];
+                    computeRotatedBox(boxCollider, worldSpace, rot, points);
+                    SDL_RenderDrawLines(renderer, points, 5);
                 }
             }
-            
+        #endif
         }
 
         // Now, reset to the default render target
@@ -862,25 +1875,86 @@ public:
         SDL_RenderPresent(renderer);
     }
 
-    void tryAddEntity(std::shared_ptr<Entity> entity) override { // Use shared_ptr
-        if (entity->getComponent<TransformComponent>() && (entity->getComponent<SpriteComponent>() || entity->getComponent<SquareComponent>())) {
-            auto layerComp = entity->getComponent<RenderLayerComponent>();
-            if (layerComp) {
-                renderLayers[layerComp->layer].push_back(entity);
-            }
-            else {
-                renderLayers[0].push_back(entity);
-            }
-        }
+    // Draws transforms this far (0 to 1) from their previous global matrix towards the current
+    // one, seen through the given camera matrix. run is the WorldSpaceSystem run that produced the
+    // current ones, see WorldSpaceSystem::getInterpolatedCameraAffine for a camera to match.
+    void setInterpolation(float alpha, uint32_t run, const Affine2Df& cameraMatrix) {
+        interpolation = alpha;
+        interpolationRun = run;
+        camera = cameraMatrix;
     }
 private:
+    struct DrawCommand {
+        int layer;
+        EntityId entity;
+        TransformComponent* transform;
+        SpriteComponent* sprite;
+        SquareComponent* shape;
+    };
+
+    // Collects everything drawable this frame, ordered by render layer. Entities with both a sprite
+    // and a square only draw the sprite.
+    void buildDrawList() {
+        drawList.clear();
+        world->view<TransformComponent, SpriteComponent, Optional<RenderLayerComponent>>().each(
+            [this](EntityId id, TransformComponent& transform, SpriteComponent& sprite, RenderLayerComponent* layer) {
+                drawList.push_back({ layer ? layer->layer : 0, id, &transform, &sprite, nullptr });
+            });
+        world->view<TransformComponent, SquareComponent, Without<SpriteComponent>, Optional<RenderLayerComponent>>().each(
+            [this](EntityId id, TransformComponent& transform, SquareComponent& shape, RenderLayerComponent* layer) {
+                drawList.push_back({ layer ? layer->layer : 0, id, &transform, nullptr, &shape });
+            });
+        sortByLayer();
+    }
+
+    // Stable counting sort over the layers in use, which are few and close together. A spread-out
+    // set of layers falls back to a comparison sort.
+    void sortByLayer() {
+        if (drawList.empty()) {
+            return;
+        }
+        auto [lowest, highest] = std::minmax_element(drawList.begin(), drawList.end(),
+            [](const DrawCommand& a, const DrawCommand& b) { return a.layer < b.layer; });
+        int64_t range = static_cast<int64_t>(highest->layer) - lowest->layer + 1;
+        if (range == 1) {
+            return;
+        }
+        if (range > MaxBucketedLayers) {
+            std::stable_sort(drawList.begin(), drawList.end(), [](const DrawCommand& a, const DrawCommand& b) { return a.layer < b.layer; });
+            return;
+        }
+
+        int base = lowest->layer;
+        layerStart.assign(static_cast<size_t>(range) + 1, 0);
+        for (const DrawCommand& command : drawList) {
+            layerStart[command.layer - base + 1]++;
+        }
+        for (size_t i = 1; i < layerStart.size(); i++) {
+            layerStart[i] += layerStart[i - 1];
+        }
+        sorted.resize(drawList.size());
+        for (const DrawCommand& command : drawList) {
+            sorted[layerStart[command.layer - base]++] = command;
+        }
+        drawList.swap(sorted);
+    }
+
+    static constexpr int64_t MaxBucketedLayers = 1024;
+
+    std::vector<DrawCommand> drawList; // Kept between frames to reuse its storage
+    std::vector<DrawCommand> sorted;
+    std::vector<size_t> layerStart; // Per layer, where its commands go in sorted
+    Batch::AffineBuffer worldSpaces; // Parallel to drawList
+    float interpolation = 1.0f;
+    uint32_t interpolationRun = 0;
+    Affine2Df camera;
     SDL_Texture* ssaaTexture;
     int ssaaFactor;
     bool showColliders;
 private:
 #ifdef _DEBUG
-    void computeRotatedBox(std::shared_ptr<BoxColliderComponent> box, float rotation, SDL_Point points[5]) {
-        SDL_Rect rect = box->getWorldSpaceRect();
+    void computeRotatedBox(BoxColliderComponent* box, const Affine2Df& worldSpace, float rotation, SDL_Point points[5]) {
+        SDL_Rect rect = box->getWorldSpaceRect(worldSpace);
         int x = rect.x;
         int y = rect.y;
         int w = rect.w;
@@ -964,264 +2038,827 @@ public:
 
     WorldSpaceSystem(std::shared_ptr<Camera> cam) : cam(cam) {}
 
+    // Only transforms changed since the last run, and the subtrees below them, are recomputed. The
+    // global matrices leave the camera out, so a moving camera costs nothing here; it is only
+    // recorded, for whatever draws through it.
     void update() {
-        for (const auto& entity : entities) {
-            auto transform = entity.lock()->getComponent<TransformComponent>();
-            if (transform) {
-                Matrix3x3<float> worldSpace = cam->getTransformMatrix() *
-                    transform->getTransformMatrix();
-                transform->setWorldSpaceMatrix(worldSpace);
+        uint32_t since = lastRun;
+        lastRun = world->advanceChangeTick();
+        run++;
+
+        Affine2Df camMatrix(cam->getTransformMatrix());
+        previousCamMatrix = since == 0 ? camMatrix : lastCamMatrix;
+        lastCamMatrix = camMatrix;
+
+        ComponentPool<HierarchyComponent>& hierarchy = world->getPool<HierarchyComponent>();
+        ComponentPool<TransformComponent>& transforms = world->getPool<TransformComponent>();
+
+        // Roots first; entities with a parent are left to the depth-ordered pass below
+        auto updateRoot = [&](EntityId entity, TransformComponent& transform) {
+            if (!hierarchy.contains(entity)) {
+                recompute(entity, transform, transform.getLocalAffine());
             }
+        };
+        if (since == 0) {
+            world->view<TransformComponent>().each(updateRoot);
+        }
+        else {
+            world->view<Changed<TransformComponent>>(since).each(updateRoot);
         }
-    }
 
-    void tryAddEntity(std::shared_ptr<Entity> entity) override {
-        if (entity->getComponent<TransformComponent>()) {
-            entities.push_back(entity);
+        if (hierarchyChanged(hierarchy, since)) {
+            // Entities that lost their parent link are roots again
+            for (EntityId entity : order) {
+                TransformComponent* transform = transforms.tryGet(entity);
+                if (transform && !hierarchy.contains(entity)) {
+                    recompute(entity, *transform, transform->getLocalAffine());
+                }
+            }
+            rebuildOrder(hierarchy);
         }
-    }
-};
 
-class CollisionSystem : public System {
-public:
-    void update() {
-        for (int i = 0; i < entities.size(); i++) {
-            for (int j = i + 1; j < entities.size(); j++) {
-                OBBCollision(entities[i], entities[j]);
+        // Parents come before their children, so a parent recomputed this run has already been
+        // written when its children are looked at
+        for (EntityId entity : order) {
+            TransformComponent* transform = transforms.tryGet(entity);
+            HierarchyComponent* link = hierarchy.tryGet(entity);
+            if (!transform || !link) {
+                continue;
+            }
+            TransformComponent* parent = transforms.tryGet(link->getParent());
+            bool dirty = since == 0 || transforms.changedTick(entity) > since || hierarchy.changedTick(entity) > since ||
+                (parent && updatedIn(link->getParent()) == run);
+            if (!dirty) {
+                continue;
             }
+            recompute(entity, *transform, parent ? parent->getGlobalAffine() * transform->getLocalAffine() : transform->getLocalAffine());
         }
     }
 
-    void tryAddEntity(std::shared_ptr<Entity> entity) override {
-        if (entity->getComponent<BoxColliderComponent>() && entity->getComponent<PhysicsComponent>()) {
-            entities.push_back(entity);
-        }
+    // The camera matrix between the last two runs, alpha 0 being the older one, to draw the
+    // interpolated global matrices through
+    Affine2Df getInterpolatedCameraAffine(float alpha) const {
+        return Affine2Df::lerp(previousCamMatrix, lastCamMatrix, alpha);
+    }
+
+    // Number of the latest run, see TransformComponent::getInterpolatedGlobalAffine
+    uint32_t getRun() const {
+        return run;
     }
+
 private:
-    std::pair<bool, Vector2f> checkOBBCollisionAndGetMTV(const OBB& obbA, const OBB& obbB) {
-        Vector2f mtv; // Minimum Translation Vector
-        float minOverlap = std::numeric_limits<float>::max();
+    void recompute(EntityId entity, TransformComponent& transform, const Affine2Df& global) {
+        transform.updateGlobalAffine(global, run);
+        if (entity.index() >= updated.size()) {
+            updated.resize(entity.index() + 1, 0);
+        }
+        updated[entity.index()] = run;
+    }
+
+    uint32_t updatedIn(EntityId entity) const {
+        return entity.index() < updated.size() ? updated[entity.index()] : 0;
+    }
 
-        // Compute the axes for SAT
-        std::vector<Vector2f> axes = obbA.getAxes();
-        std::vector<Vector2f> axesB = obbB.getAxes();
-        axes.insert(axes.end(), axesB.begin(), axesB.end());
+    // Links added, removed or re-parented since the last run. Removals don't stamp a tick, so the
+    // size catches those.
+    bool hierarchyChanged(const ComponentPool<HierarchyComponent>& hierarchy, uint32_t since) const {
+        if (since == 0 || hierarchy.size() != order.size()) {
+            return true;
+        }
+        for (uint32_t tick : hierarchy.getTicks()) {
+            if (tick > since) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Flattens the hierarchy breadth-first: every linked entity sorted by its depth below a root
+    void rebuildOrder(ComponentPool<HierarchyComponent>& hierarchy) {
+        std::vector<std::pair<size_t, EntityId>> byDepth;
+        byDepth.reserve(hierarchy.size());
+        hierarchy.each([&](EntityId entity, HierarchyComponent& link) {
+            size_t depth = 0;
+            EntityId parent = link.getParent();
+            while (HierarchyComponent* up = hierarchy.tryGet(parent)) {
+                parent = up->getParent();
+                if (++depth > hierarchy.size()) {
+                    break; // Cycle, its members are updated in no particular order
+                }
+            }
+            byDepth.emplace_back(depth, entity);
+        });
+        std::stable_sort(byDepth.begin(), byDepth.end(), [](const auto& a, const auto& b) {
+            return a.first < b.first;
+        });
+
+        order.clear();
+        for (auto& [depth, entity] : byDepth) {
+            order.push_back(entity);
+        }
+    }
 
-        // Check overlap along each axis
-        for (Vector2f& axis : axes) {
-            float minA, maxA, minB, maxB;
+    uint32_t lastRun = 0;
+    uint32_t run = 0;
+    Affine2Df lastCamMatrix;
+    Affine2Df previousCamMatrix; // As of the run before
+    std::vector<EntityId> order; // Entities with a parent, parents before children
+    std::vector<uint32_t> updated; // Run in which each entity slot's matrices were last written
+};
 
-            obbA.projectOntoAxis(axis, minA, maxA);
-            obbB.projectOntoAxis(axis, minB, maxB);
+enum class BroadphaseType {
+    SpatialHash, // Uniform grid rebuilt every frame, for many similar-sized movers
+    AABBTree, // Persistent tree, for mostly static scenes and widely varying sizes
+};
 
-            float overlap = std::min(maxA, maxB) - std::max(minA, minB);
+class CollisionSystem : public System {
+public:
+    // Colliders are compared in scene space, so a moving camera doesn't make every collider look
+    // like it moved
+    CollisionSystem() {
+        requireComponents<BoxColliderComponent, PhysicsComponent>();
+    }
 
-            // If no overlap found on any axis, no collision
-            if (overlap <= 0) {
-                return { false, {} };
+    // Finds the candidate pairs with the broadphase and runs the narrowphase only on those. Pairs
+    // are handled in the same order as testing every pair would.
+    void update() {
+        auto& transforms = world->getPool<TransformComponent>();
+        grid.clear();
+        colliders.assign(entities.size(), Collider());
+        shapes.resize(entities.size());
+        motion.assign(entities.size(), Static);
+        bodies.assign(entities.size(), nullptr);
+        for (size_t i = 0; i < entities.size(); i++) {
+            Entity* entity = world->getEntity(entities[i]);
+            if (!entity) {
+                continue;
+            }
+            auto box = entity->getComponent<BoxColliderComponent>();
+            auto physics = entity->getComponent<PhysicsComponent>();
+            if (physics->movedWhileAsleep(transforms.changedTick(entities[i]))) {
+                physics->wake();
+            }
+            if (!physics->isStatic) {
+                motion[i] = physics->isSleeping ? Sleeping : Awake;
+            }
+            if (motion[i] == Awake) {
+                physics->isGrounded = false;
+            }
+            bodies[i] = physics;
+            const CachedShape& cached = shapeOf(entities[i], transforms.get(entities[i]), *box);
+            AABB bounds = cached.bounds;
+            shapes[i] = cached.shape;
+
+            // Pairs the layers rule out never reach the narrowphase
+            ProxyFilter filter{ box->getCategoryBits(), box->getMaskBits() & collisionMatrix.getMask(box->getLayer()) };
+            colliders[i] = { entities[i], bounds, filter };
+
+            uint32_t key = entities[i].index();
+            if (key >= memberSlot.size()) {
+                memberSlot.resize(key + 1);
+            }
+            memberSlot[key] = static_cast<uint32_t>(i);
+            if (broadphase == BroadphaseType::SpatialHash) {
+                grid.insert(static_cast<uint32_t>(i), bounds, filter);
             }
             else {
-                if (overlap < minOverlap) {
-                    minOverlap = overlap;
-                    if (maxB - minA < maxA - minB) {
-                        mtv = -axis * overlap;
-                    }
-                    else {
-                        mtv = axis * overlap;
-                    }
+                tree.update(key, bounds, filter);
+            }
+        }
+
+        pairs.clear();
+        if (broadphase == BroadphaseType::SpatialHash) {
+            grid.findPairs(pairs);
+        }
+        else {
+            tree.findPairs(pairs);
+            for (auto& [a, b] : pairs) {
+                a = memberSlot[a];
+                b = memberSlot[b];
+                if (a > b) {
+                    std::swap(a, b);
+                }
+            }
+        }
+        std::sort(pairs.begin(), pairs.end());
+        skipRestingPairs();
+
+        // The shapes were all taken before anything moves, so every pair can be tested up front
+        narrowphase();
+        solver.clear();
+        solverBody.assign(entities.size(), NoSolverBody);
+        solvedPairs.clear();
+        for (const SATHit& hit : hits) {
+            auto [i, j] = pairs[hit.pair];
+            Entity* entityA = world->getEntity(colliders[i].entity);
+            Entity* entityB = world->getEntity(colliders[j].entity);
+            if (entityA && entityB) {
+                // An awake body running into a sleeping one wakes it
+                if (motion[i] == Sleeping && motion[j] == Awake) {
+                    entityA->getComponent<PhysicsComponent>()->wake();
                 }
+                else if (motion[j] == Sleeping && motion[i] == Awake) {
+                    entityB->getComponent<PhysicsComponent>()->wake();
+                }
+                OBBCollision(i, j, hit.mtv);
             }
         }
+        solveContacts();
 
-        return { true, mtv };
+        // Scripts hear about every contact once the step is resolved
+        contacts.sweep(
+            [this](const Contact& contact) { notify(contact, true, false); },
+            [this](const Contact& contact) { notify(contact, false, false); },
+            [this](const Contact& contact) { notify(contact, false, true); });
     }
 
-    void resolveAndRespondToCollision(std::weak_ptr<Entity> entityA, std::weak_ptr<Entity> entityB, OBB obbA, OBB obbB, Vector2f& mtv) {
-        auto transformA = entityA.lock()->getComponent<TransformComponent>();
-        auto transformB = entityB.lock()->getComponent<TransformComponent>();
-        auto physicsA = entityA.lock()->getComponent<PhysicsComponent>();
-        auto physicsB = entityB.lock()->getComponent<PhysicsComponent>();
-        if (abs(mtv.x) < 0.01f && mtv.y > 0 && physicsA->velocity.y > 0) {
-            physicsA->velocity.y = 0;  // Reset the downward velocity
-            physicsA->isGrounded = true;
-        }
+    // Contacts touching as of the last update, with the impulses the solver ended on
+    ContactCache& getContacts() {
+        return contacts;
+    }
 
-        float minOverlap = std::numeric_limits<float>::max();
+    ContactSolverSettings& getSolverSettings() {
+        return solver.settings;
+    }
 
-        // Compute the axes for SAT
-        std::vector<Vector2f> axes = obbA.getAxes();
-        std::vector<Vector2f> axesB = obbB.getAxes();
-        axes.insert(axes.end(), axesB.begin(), axesB.end());
+    // Threads besides the caller's that share the SAT tests. Results, and so the order contacts
+    // are resolved and reported in, don't depend on the count.
+    void setWorkerThreads(size_t count) {
+        pool = count > 0 ? std::make_unique<PC::ThreadPool>(count) : nullptr;
+        workerCount = count;
+    }
 
-        // Check overlap along each axis
-        for (Vector2f& axis : axes) {
-            float minA, maxA, minB, maxB;
+    void setBroadphase(BroadphaseType type) {
+        broadphase = type;
+        tree.clear();
+    }
 
-            obbA.projectOntoAxis(axis, minA, maxA);
-            obbB.projectOntoAxis(axis, minB, maxB);
+    BroadphaseType getBroadphase() const {
+        return broadphase;
+    }
 
-            float overlap = std::min(maxA, maxB) - std::max(minA, minB);
+    // Grid cell size of the spatial hash
+    void setCellSize(float size) {
+        grid.setCellSize(size);
+    }
 
-            // If no overlap found on any axis, no collision
-            if (overlap <= 0) {
-                return;
+    float getCellSize() const {
+        return grid.getCellSize();
+    }
+
+    // How far the AABB tree's boxes extend past the colliders, i.e. how far a collider can move
+    // before it is reinserted
+    void setTreeMargin(float margin) {
+        tree.setMargin(margin);
+    }
+
+    // Entities whose collider bounds overlap the area, in scene coordinates, as of the last update
+    void queryArea(const AABB& area, std::vector<EntityId>& result) const {
+        if (broadphase == BroadphaseType::AABBTree) {
+            tree.query(area, [&](uint32_t key) { result.push_back(colliders[memberSlot[key]].entity); });
+            return;
+        }
+        for (const Collider& collider : colliders) {
+            if (collider.entity.isValid() && collider.bounds.overlaps(area)) {
+                result.push_back(collider.entity);
             }
-            else {
-                if (overlap < minOverlap) {
-                    minOverlap = overlap;
-                    if (maxB - minA < maxA - minB) {
-                        mtv = -axis * overlap;
-                    }
-                    else {
-                        mtv = axis * overlap;
-                    }
+        }
+    }
+
+    // Sweeps the entity's collider bounds, moved by offset, along motion against the other colliders
+    // it may collide with, taken as fixed where the last update left them. On a hit, toi is the
+    // fraction of motion at first contact and normal the face that was hit. Colliders it already
+    // overlaps are left to the contact solver. Scene coordinates; rotated colliders are swept as
+    // their bounding boxes.
+    bool sweep(EntityId mover, const Vector2f& offset, const Vector2f& motion, float& toi, Vector2f& normal) const {
+        uint32_t index = mover.index();
+        if (index >= memberSlot.size() || memberSlot[index] >= colliders.size() || colliders[memberSlot[index]].entity != mover) {
+            return false;
+        }
+        const Collider& self = colliders[memberSlot[index]];
+        AABB start(self.bounds.min + offset, self.bounds.max + offset);
+        AABB swept = start.merged(AABB(start.min + motion, start.max + motion));
+
+        bool hit = false;
+        toi = 1.0f;
+        auto test = [&](const Collider& other) {
+            float time;
+            Vector2f face;
+            if (other.entity != mover && self.filter.accepts(other.filter) && start.sweep(other.bounds, motion, time, face) && time < toi) {
+                toi = time;
+                normal = face;
+                hit = true;
+            }
+        };
+        if (broadphase == BroadphaseType::AABBTree) {
+            tree.query(swept, [&](uint32_t key) { test(colliders[memberSlot[key]]); });
+        }
+        else {
+            for (const Collider& collider : colliders) {
+                if (collider.entity.isValid() && collider.bounds.overlaps(swept)) {
+                    test(collider);
                 }
             }
         }
+        return hit;
+    }
 
-        // Translate entities by the MTV to resolve the collision
-        Vector2f posA = transformA->getPosition();
-        Vector2f posB = transformB->getPosition();
-
-        //std::cout << mtv << std::endl;
-        if (!physicsA->isStatic && !physicsB->isStatic) {
-            posA -= mtv * 0.5f;
-            posB += mtv * 0.5f;
+    // Entities whose collider bounds the segment passes through, in scene coordinates, as of the last update
+    void rayCast(const Vector2f& from, const Vector2f& to, std::vector<EntityId>& result) const {
+        if (broadphase == BroadphaseType::AABBTree) {
+            tree.rayCast(from, to, [&](uint32_t key) { result.push_back(colliders[memberSlot[key]].entity); });
+            return;
+        }
+        for (const Collider& collider : colliders) {
+            if (collider.entity.isValid() && collider.bounds.intersectsSegment(from, to)) {
+                result.push_back(collider.entity);
+            }
         }
-        else if (!physicsA->isStatic) {
-            posA -= mtv;
+    }
+
+private:
+    // Separating axis test over the edge normals of both boxes. On overlap, mtv is the smallest
+    // translation that separates them, pointing from A to B.
+    static bool checkOBBCollisionAndGetMTV(const OBBShape& shapeA, const OBBShape& shapeB, Vector2f& mtv) {
+        return BatchSAT::test(shapeA, shapeB, mtv);
+    }
+
+    struct CachedShape {
+        EntityId entity;
+        uint32_t tick = 0; // Global tick of the transform it was built from
+        Vector2f size; // Local size it was built from
+        OBBShape shape;
+        AABB bounds;
+    };
+
+    // The collider's shape and bounds, rebuilt only when its global matrix has been written since
+    // they were built or its size has changed (a sprite's frames needn't all be the same size)
+    const CachedShape& shapeOf(EntityId entity, const TransformComponent& transform, BoxColliderComponent& box) {
+        uint32_t key = entity.index();
+        if (key >= shapeCache.size()) {
+            shapeCache.resize(key + 1);
         }
-        else if (!physicsB->isStatic) {
-            posB += mtv;
+        CachedShape& cached = shapeCache[key];
+        Vector2f size = box.getLocalSize();
+        if (cached.entity != entity || cached.tick != transform.getGlobalTick() || cached.size != size) {
+            OBB obb = box.getGlobalOBB(transform.getGlobalAffine(), size);
+            cached = { entity, transform.getGlobalTick(), size, OBBShape(obb), obb.getBounds() };
         }
+        return cached;
+    }
 
-        transformA->setPosition(posA);
-        transformB->setPosition(posB);
+    // Solver index of the body in the given member slot, adding it on first use
+    uint32_t solverBodyOf(size_t slot) {
+        if (solverBody[slot] == NoSolverBody) {
+            PhysicsComponent* physics = bodies[slot];
+            solverBody[slot] = physics->isStatic ? solver.addBody(Vector2f(0, 0), 0.0f) :
+                solver.addBody(physics->velocity, physics->inverseMass);
+        }
+        return solverBody[slot];
+    }
 
-        // Collision response (adjust velocities, etc.)
-        // This can be expanded further for more realistic response.
-        if (!physicsA->isStatic && !physicsB->isStatic) {
-            float totalMass = physicsA->mass + physicsB->mass;
-            Vector2f velocityA = physicsA->velocity;
-            Vector2f velocityB = physicsB->velocity;
+    // Runs the solver over the frame's contacts, then hands the velocities and position fixes back
+    // to the bodies and keeps the impulses in the contact cache for the next frame
+    void solveContacts() {
+        solver.solve();
 
-            physicsA->velocity = velocityA - 2 * physicsB->mass / totalMass * (velocityA - velocityB);
-            physicsB->velocity = velocityB - 2 * physicsA->mass / totalMass * (velocityB - velocityA);
+        auto& transforms = world->getPool<TransformComponent>();
+        for (size_t i = 0; i < solverBody.size(); i++) {
+            if (solverBody[i] == NoSolverBody || bodies[i]->isStatic) {
+                continue;
+            }
+            bodies[i]->velocity = solver.getVelocity(solverBody[i]);
+            Vector2f shift = solver.getShift(solverBody[i]);
+            TransformComponent* transform = transforms.tryGet(colliders[i].entity);
+            if (transform && (shift.x != 0.0f || shift.y != 0.0f)) {
+                transform->setPosition(transform->getPosition() + shift);
+                colliders[i].bounds = AABB(colliders[i].bounds.min + shift, colliders[i].bounds.max + shift);
+            }
+        }
 
-            physicsA->isGrounded = false;
-            physicsB->isGrounded = false;
+        // A contact whose normal is close to vertical holds up the body on top (y points down)
+        static constexpr float GroundNormal = 0.7f;
+        for (size_t k = 0; k < solvedPairs.size(); k++) {
+            auto [i, j] = solvedPairs[k];
+            Contact* contact = contacts.find(colliders[i].entity, colliders[j].entity);
+            contact->normalImpulse = solver.getNormalImpulse(k);
+            contact->tangentImpulse = solver.getTangentImpulse(k);
+            if (contact->normalImpulse > 0.0f) {
+                Vector2f normal = solver.getNormal(k);
+                if (normal.y > GroundNormal) {
+                    bodies[i]->isGrounded = true;
+                }
+                else if (normal.y < -GroundNormal) {
+                    bodies[j]->isGrounded = true;
+                }
+            }
         }
     }
 
-    void OBBCollision(std::weak_ptr<Entity> entityA, std::weak_ptr<Entity> entityB) {
-        auto boxA = entityA.lock()->getComponent<BoxColliderComponent>();
-        auto boxB = entityB.lock()->getComponent<BoxColliderComponent>();
+    // Drops the pairs with a sleeping body and no awake one, since neither side can have moved.
+    // Their contacts are kept as they were, so islands stay together and no exit is reported.
+    void skipRestingPairs() {
+        size_t kept = 0;
+        for (const ProxyPair& pair : pairs) {
+            Motion a = motion[pair.first];
+            Motion b = motion[pair.second];
+            if (a != Awake && b != Awake && (a == Sleeping || b == Sleeping)) {
+                EntityId idA = colliders[pair.first].entity;
+                EntityId idB = colliders[pair.second].entity;
+                if (contacts.find(idA, idB)) {
+                    contacts.touch(idA, idB);
+                }
+                continue;
+            }
+            pairs[kept++] = pair;
+        }
+        pairs.resize(kept);
+    }
 
-        auto scriptA = entityA.lock()->getComponent<ScriptComponent>();
-        auto scriptB = entityB.lock()->getComponent<ScriptComponent>();
+    // Runs the SAT on every candidate pair into hits, in pair order. With worker threads, the pair
+    // list is cut into contiguous ranges, each tested into its own buffer; the buffers are then
+    // joined in range order, which is pair order again.
+    void narrowphase() {
+        static constexpr size_t MinPairsPerTask = 256;
 
-        OBB obbA = boxA->getWorldSpaceOBB();
-        OBB obbB = boxB->getWorldSpaceOBB();
+        hits.clear();
+        size_t tasks = pool ? std::min(workerCount + 1, pairs.size() / MinPairsPerTask) : 0;
+        if (tasks < 2) {
+            sat.run(shapes.data(), pairs.data(), pairs.size(), hits);
+            return;
+        }
 
-        auto [isOverlapping, mtv] = checkOBBCollisionAndGetMTV(obbA, obbB);
-        if (isOverlapping) {
-            if (collisionMatrix.shouldCollide(boxA->getLayer(), boxB->getLayer())) {
-                resolveAndRespondToCollision(entityA, entityB, obbA, obbB, mtv); 
+        if (workers.size() < tasks) {
+            workers.resize(tasks);
+        }
+        size_t perTask = (pairs.size() + tasks - 1) / tasks;
+        auto testRange = [this, perTask](size_t task) {
+            Worker& worker = workers[task];
+            size_t begin = task * perTask;
+            size_t end = std::min(pairs.size(), begin + perTask);
+            worker.hits.clear();
+            worker.sat.run(shapes.data(), pairs.data() + begin, end - begin, worker.hits);
+            for (SATHit& hit : worker.hits) {
+                hit.pair += static_cast<uint32_t>(begin);
             }
+        };
 
-            if (scriptA) {
-                scriptA->onCollision(entityB.lock());
-            }
-            if (scriptB) {
-                scriptB->onCollision(entityA.lock());
-            }
+        // The calling thread takes the last range
+        std::vector<std::future<void>> pending;
+        pending.reserve(tasks - 1);
+        for (size_t task = 0; task + 1 < tasks; task++) {
+            pending.push_back(pool->enqueue(testRange, task));
+        }
+        testRange(tasks - 1);
+        for (auto& result : pending) {
+            result.get();
+        }
 
-            currentCollisions.insert({ entityA.lock().get(), entityB.lock().get() });
+        for (size_t task = 0; task < tasks; task++) {
+            hits.insert(hits.end(), workers[task].hits.begin(), workers[task].hits.end());
         }
-        else {
-            if (currentCollisions.count({ entityA.lock().get(), entityB.lock().get() }) > 0) {
-                currentCollisions.erase({ entityA.lock().get(), entityB.lock().get() });
-                if (scriptA) {
-                    scriptA->onCollisionExit(entityB.lock());
-                }
-                if (scriptB) {
-                    scriptB->onCollisionExit(entityA.lock());
-                }
+    }
+
+    // Handles a pair the SAT found overlapping; mtv is its Minimum Translation Vector. The contact
+    // goes to the solver, warm started with the impulses it had last frame.
+    void OBBCollision(size_t i, size_t j, const Vector2f& mtv) {
+        Contact& contact = contacts.touch(colliders[i].entity, colliders[j].entity);
+        contact.mtv = mtv;
+        const PhysicsComponent& physicsA = *bodies[i];
+        const PhysicsComponent& physicsB = *bodies[j];
+        solver.addContact(solverBodyOf(i), solverBodyOf(j), mtv, std::sqrt(physicsA.friction * physicsB.friction),
+            std::max(physicsA.restitution, physicsB.restitution), contact.normalImpulse, contact.tangentImpulse);
+        solvedPairs.push_back({ static_cast<uint32_t>(i), static_cast<uint32_t>(j) });
+    }
+
+    // Passes a contact event on to both entities' scripts. An entity destroyed in the meantime
+    // doesn't hear about it, but its partner still gets the exit, so a contact that ends because one
+    // side died is reported like any other. Enter and stay need both sides alive. The script
+    // component is looked up again for every call, since a script may have changed the storage it
+    // lives in.
+    void notify(const Contact& contact, bool began, bool ended) {
+        auto send = [this](EntityId self, EntityId other, void (ScriptComponent::*event)(EntityId)) {
+            Entity* entity = world->getEntity(self);
+            if (ScriptComponent* scripts = entity ? entity->getComponent<ScriptComponent>() : nullptr) {
+                (scripts->*event)(other);
             }
+        };
+        if (ended) {
+            send(contact.a, contact.b, &ScriptComponent::onCollisionExit);
+            send(contact.b, contact.a, &ScriptComponent::onCollisionExit);
+            return;
+        }
+        if (!world->getEntity(contact.a) || !world->getEntity(contact.b)) {
+            return;
         }
+        if (began) {
+            send(contact.a, contact.b, &ScriptComponent::onCollisionEnter);
+            send(contact.b, contact.a, &ScriptComponent::onCollisionEnter);
+        }
+        send(contact.a, contact.b, &ScriptComponent::onCollision);
+        send(contact.b, contact.a, &ScriptComponent::onCollision);
     }
 
 public:
     CollisionMatrix collisionMatrix;
 private:
-    std::set<std::pair<Entity*, Entity*>> currentCollisions;
-    
+    ContactCache contacts;
+    struct Collider {
+        EntityId entity;
+        AABB bounds;
+        ProxyFilter filter;
+    };
+
+    BroadphaseType broadphase = BroadphaseType::SpatialHash;
+    SpatialHashGrid grid;
+    AABBTreeBroadphase tree;
+    std::vector<uint32_t> memberSlot; // Position in entities by entity slot, which is also the tree's key
+    std::vector<Collider> colliders; // Scene space bounds of the last update, parallel to entities
+    std::vector<OBBShape> shapes; // Scene space, parallel to entities
+
+    std::vector<CachedShape> shapeCache; // By entity slot
+    enum Motion : uint8_t { Static, Sleeping, Awake };
+    std::vector<Motion> motion; // Parallel to entities
+    std::vector<PhysicsComponent*> bodies; // Parallel to entities
+
+    static constexpr uint32_t NoSolverBody = std::numeric_limits<uint32_t>::max();
+    ContactSolver solver;
+    std::vector<uint32_t> solverBody; // Solver index by member slot, for the bodies in a contact
+    std::vector<ProxyPair> solvedPairs; // Member slots of the solver's contacts, in its order
+    std::vector<ProxyPair> pairs;
+    BatchSAT sat;
+    std::vector<SATHit> hits;
+
+    struct Worker {
+        BatchSAT sat;
+        std::vector<SATHit> hits;
+    };
+    std::unique_ptr<PC::ThreadPool> pool;
+    size_t workerCount = 0;
+    std::vector<Worker> workers; // One per range of the pair list
+
+};
+
+// Bodies awake and asleep as of the last physics update
+struct PhysicsStats {
+    size_t awake = 0;
+    size_t sleeping = 0;
+    size_t islands = 0; // Groups of touching bodies with at least two members
+
+    bool operator==(const PhysicsStats& other) const {
+        return awake == other.awake && sleeping == other.sleeping && islands == other.islands;
+    }
+
+    bool operator!=(const PhysicsStats& other) const {
+        return !(*this == other);
+    }
 };
 
+// Integrates the awake bodies in two halves around the collision system's contact solver, then
+// puts resting ones to sleep. Bodies are grouped into islands through the contacts they touch
+// (static bodies don't join them, or the ground would tie everything together). An island only
+// sleeps once all of its bodies have been slower than the sleep velocity for the sleep delay, and
+// wakes as a whole when one of them wakes.
 class PhysicsSystem : public System {
 public:
     const Vector2f gravity = Vector2f(0, 9.8f);
 
+    PhysicsSystem(std::shared_ptr<CollisionSystem> collisionSystem = nullptr) : collisionSystem(collisionSystem) {}
+
+    // Turns gravity and the forces applied since the last frame into velocity. Runs before the
+    // collision system, so the contact solver works on this frame's velocities and holds resting
+    // bodies up against gravity.
+    void integrateForces() {
+        world->view<PhysicsComponent>().each([this](PhysicsComponent& physics) {
+            if (physics.isStatic || physics.isSleeping) {
+                return;
+            }
+
+            if (physics.isAffectedByGravity) {
+                // Apply gravity. Not through applyForce, which would keep the body awake.
+                physics.acceleration += gravity;
+            }
+
+            // Update velocity based on acceleration
+            physics.velocity += physics.acceleration;
+
+            // Apply damping to the velocity
+            physics.velocity *= physics.damping;
+
+            // Reset acceleration for next frame
+            physics.acceleration = Vector2f(0, 0);
+        });
+    }
+
+    // Moves the awake bodies by their solved velocities, then updates sleeping
     void update(float deltaTime) {
-        for (const auto& entity : entities) {
-            auto physics = entity.lock()->getComponent<PhysicsComponent>();
-            if (physics && !physics->isStatic) {
-                if (physics->isAffectedByGravity && !physics->isGrounded) {
-                    // Apply gravity
-                    physics->applyForce(gravity * physics->mass);
-                }
+        auto& transforms = world->getPool<TransformComponent>();
+        bodies.clear();
+        world->view<PhysicsComponent, TransformComponent>().each([&](EntityId entity, PhysicsComponent& physics, TransformComponent& transform) {
+            if (physics.isStatic) {
+                return;
+            }
+            if (physics.movedWhileAsleep(transforms.changedTick(entity))) {
+                physics.wake();
+            }
+            bodies.push_back({ entity, &physics, 0 });
+            if (physics.isSleeping) {
+                return;
+            }
+
+            // Update position based on velocity
+            Vector2f pos = transform.getPosition();
+            if (physics.isFast && collisionSystem) {
+                pos += sweptMotion(entity, physics, deltaTime);
+            }
+            else {
+                pos += physics.velocity * deltaTime;
+            }
+            transform.setPosition(pos);
+
+            bool resting = physics.canSleep &&
+                physics.velocity.x * physics.velocity.x + physics.velocity.y * physics.velocity.y < sleepVelocity * sleepVelocity;
+            physics.sleepTime = resting ? physics.sleepTime + deltaTime : 0.0f;
+        });
 
-                // Update velocity based on acceleration
-                physics->velocity += physics->acceleration;
+        updateIslands();
+    }
 
-                // Apply damping to the velocity
-                physics->velocity *= physics->damping;
+    // Speed, in units per second, below which a body counts as resting
+    void setSleepVelocity(float velocity) {
+        sleepVelocity = velocity;
+    }
 
-                // Update position based on velocity
-                auto transform = entity.lock()->getComponent<TransformComponent>();
-                if (transform) {
-                    Vector2f pos = transform->getPosition();
-                    pos += physics->velocity * deltaTime;
-                    transform->setPosition(pos);
-                }
+    // Seconds a whole island has to rest before it sleeps. Zero or less turns sleeping off.
+    void setSleepDelay(float seconds) {
+        sleepDelay = seconds;
+    }
+
+    const PhysicsStats& getStats() const {
+        return stats;
+    }
+
+private:
+    struct Body {
+        EntityId entity;
+        PhysicsComponent* physics = nullptr;
+        uint32_t parent = 0; // Union-find link into bodies
+    };
+
+    // How far a fast body gets this step. Each substep moves it up to the first collider in its
+    // way; if there is time left it bounces off and goes on. The last hit stops it just inside the
+    // collider's face, so the next collision update finds the contact and resolves it.
+    Vector2f sweptMotion(EntityId entity, PhysicsComponent& physics, float deltaTime) {
+        Vector2f moved(0, 0);
+        float remaining = deltaTime;
+        int substeps = std::max(physics.substeps, 1);
+        for (int substep = 0; substep < substeps && remaining > 0.0f; substep++) {
+            Vector2f motion = physics.velocity * remaining;
+            float toi;
+            Vector2f normal;
+            if (!collisionSystem->sweep(entity, moved, motion, toi, normal)) {
+                return moved + motion;
+            }
+            moved += motion * toi;
+            remaining -= remaining * toi;
+            if (substep == substeps - 1) {
+                return moved - normal * collisionSystem->getSolverSettings().slop;
+            }
 
-                // Reset acceleration for next frame
-                physics->acceleration = Vector2f(0, 0);
+            // Bounce off the face, taking the collider as immovable
+            float closing = physics.velocity.x * normal.x + physics.velocity.y * normal.y;
+            if (closing < 0.0f) {
+                physics.velocity -= normal * (closing * (1.0f + physics.restitution));
             }
         }
+        return moved;
     }
 
-    void tryAddEntity(std::shared_ptr<Entity> entity) override {
-        if (entity->getComponent<PhysicsComponent>()) {
-            entities.push_back(entity);
+    uint32_t findRoot(uint32_t body) {
+        while (bodies[body].parent != body) {
+            bodies[body].parent = bodies[bodies[body].parent].parent;
+            body = bodies[body].parent;
         }
+        return body;
     }
+
+    // Position in bodies, or NoBody for static bodies and stale handles
+    uint32_t bodyOf(EntityId entity) const {
+        uint32_t index = entity.index();
+        if (index >= bodySlot.size() || bodySlot[index] >= bodies.size() || bodies[bodySlot[index]].entity != entity) {
+            return NoBody;
+        }
+        return bodySlot[index];
+    }
+
+    void updateIslands() {
+        for (uint32_t i = 0; i < bodies.size(); i++) {
+            bodies[i].parent = i;
+            uint32_t index = bodies[i].entity.index();
+            if (index >= bodySlot.size()) {
+                bodySlot.resize(index + 1, NoBody);
+            }
+            bodySlot[index] = i;
+        }
+
+        if (collisionSystem) {
+            collisionSystem->getContacts().each([this](const Contact& contact) {
+                uint32_t a = bodyOf(contact.a);
+                uint32_t b = bodyOf(contact.b);
+                if (a != NoBody && b != NoBody) {
+                    bodies[findRoot(a)].parent = findRoot(b);
+                }
+            });
+        }
+
+        // Per island: the shortest rest of its bodies, whether one of them is awake, and its size
+        islands.assign(bodies.size(), Island());
+        for (uint32_t i = 0; i < bodies.size(); i++) {
+            Island& island = islands[findRoot(i)];
+            const PhysicsComponent& physics = *bodies[i].physics;
+            island.minSleepTime = std::min(island.minSleepTime, physics.isSleeping ? sleepDelay : physics.sleepTime);
+            island.awake |= !physics.isSleeping;
+            island.size++;
+        }
+
+        stats = PhysicsStats();
+        uint32_t tick = world->getChangeTick();
+        for (uint32_t i = 0; i < bodies.size(); i++) {
+            const Island& island = islands[findRoot(i)];
+            PhysicsComponent& physics = *bodies[i].physics;
+            if (sleepDelay > 0.0f && island.minSleepTime >= sleepDelay) {
+                if (!physics.isSleeping) {
+                    physics.isSleeping = true;
+                    physics.sleepTick = tick;
+                    physics.velocity = Vector2f(0, 0);
+                    physics.acceleration = Vector2f(0, 0);
+                }
+            }
+            else if (island.awake && physics.isSleeping) {
+                physics.wake();
+            }
+            (physics.isSleeping ? stats.sleeping : stats.awake)++;
+            if (island.size > 1 && findRoot(i) == i) {
+                stats.islands++;
+            }
+        }
+    }
+
+    static constexpr uint32_t NoBody = std::numeric_limits<uint32_t>::max();
+
+    struct Island {
+        float minSleepTime = std::numeric_limits<float>::max();
+        bool awake = false;
+        uint32_t size = 0;
+    };
+
+    std::shared_ptr<CollisionSystem> collisionSystem; // Source of the contacts islands are built from
+    float sleepVelocity = 10.0f;
+    float sleepDelay = 0.5f;
+    std::vector<Body> bodies; // Dynamic bodies of the current update
+    std::vector<uint32_t> bodySlot; // Position in bodies, by entity slot
+    std::vector<Island> islands; // Indexed by the island's root body
+    PhysicsStats stats;
 };
 
 class ScriptSystem : public System {
 public:
+    ScriptSystem() {
+        requireComponents<ScriptComponent>();
+    }
+
     void start() {
-        for (const auto& entity : entities) {
-            auto script = entity.lock()->getComponent<ScriptComponent>();
-            if (script) {
-                script->start();
-            }
-        }
+        started = true;
+        pendingStarts.clear();
+        world->getPool<ScriptComponent>().each([](EntityId, ScriptComponent& script) {
+            script.start();
+        });
     }
 
     void update(float deltaTime) {
-        for (const auto& entity : entities) {
-            auto script = entity.lock()->getComponent<ScriptComponent>();
-            if (script) {
-                script->update(deltaTime);
+        auto& scripts = world->getPool<ScriptComponent>();
+
+        // Scripts of entities spawned since the last frame start before their first update. Indexed
+        // loop, since a starting script may spawn more.
+        for (size_t i = 0; i < pendingStarts.size(); i++) {
+            if (ScriptComponent* script = scripts.tryGet(pendingStarts[i])) {
+                script->start();
             }
         }
+        pendingStarts.clear();
+
+        scripts.each([deltaTime](EntityId, ScriptComponent& script) {
+            script.update(deltaTime);
+        });
     }
 
-    void tryAddEntity(std::shared_ptr<Entity> entity) override {
-        if (entity->getComponent<ScriptComponent>()) {
-            entities.push_back(entity);
+    void onEntityAdded(EntityId entity) override {
+        if (started) {
+            pendingStarts.push_back(entity);
         }
     }
-};
 
+private:
+    bool started = false;
+    std::vector<EntityId> pendingStarts;
+};
\ No newline at end of file
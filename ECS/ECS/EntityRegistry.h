@@ -0,0 +1,112 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <functional>
+
+class Entity;
+
+// Lightweight 32-bit handle to an entity: a slot index plus the generation the slot had when the
+// handle was made. Slots are recycled, so a handle to a destroyed entity is caught by its generation.
+struct EntityId {
+    static constexpr uint32_t IndexBits = 20;
+    static constexpr uint32_t GenerationBits = 12;
+    static constexpr uint32_t IndexMask = (1u << IndexBits) - 1;
+    static constexpr uint32_t GenerationMask = (1u << GenerationBits) - 1;
+    static constexpr uint32_t Invalid = 0xFFFFFFFF;
+
+    uint32_t value = Invalid;
+
+    constexpr EntityId() = default;
+
+    constexpr EntityId(uint32_t index, uint32_t generation)
+        : value(((generation & GenerationMask) << IndexBits) | (index & IndexMask)) {}
+
+    uint32_t index() const {
+        return value & IndexMask;
+    }
+
+    uint32_t generation() const {
+        return value >> IndexBits;
+    }
+
+    bool isValid() const {
+        return value != Invalid;
+    }
+
+    bool operator==(const EntityId& other) const {
+        return value == other.value;
+    }
+
+    bool operator!=(const EntityId& other) const {
+        return value != other.value;
+    }
+
+    bool operator<(const EntityId& other) const {
+        return value < other.value;
+    }
+};
+
+namespace std {
+    template <>
+    struct hash<EntityId> {
+        size_t operator()(const EntityId& id) const {
+            return std::hash<uint32_t>()(id.value);
+        }
+    };
+}
+
+// Hands out entity slots and maps handles back to entities. Freed slots are recycled oldest first,
+// which spreads reuse across slots and keeps generations from wrapping quickly.
+class EntityRegistry {
+public:
+    EntityId create(Entity* entity) {
+        uint32_t index;
+        if (!freeSlots.empty()) {
+            index = freeSlots.front();
+            freeSlots.pop_front();
+        }
+        else {
+            index = static_cast<uint32_t>(slots.size());
+            assert(index < EntityId::IndexMask && "too many entities");
+            slots.push_back({ nullptr, 0 });
+        }
+        slots[index].entity = entity;
+        return EntityId(index, slots[index].generation);
+    }
+
+    void destroy(EntityId id) {
+        if (!isAlive(id)) {
+            return;
+        }
+        Slot& slot = slots[id.index()];
+        slot.entity = nullptr;
+        slot.generation = (slot.generation + 1) & EntityId::GenerationMask;
+        freeSlots.push_back(id.index());
+    }
+
+    bool isAlive(EntityId id) const {
+        return id.isValid() && id.index() < slots.size() &&
+            slots[id.index()].entity && slots[id.index()].generation == id.generation();
+    }
+
+    // Returns nullptr for stale or invalid handles
+    Entity* get(EntityId id) const {
+        return isAlive(id) ? slots[id.index()].entity : nullptr;
+    }
+
+    size_t size() const {
+        return slots.size() - freeSlots.size();
+    }
+
+private:
+    struct Slot {
+        Entity* entity;
+        uint32_t generation;
+    };
+
+    std::vector<Slot> slots;
+    std::deque<uint32_t> freeSlots;
+};
@@ -4,20 +4,15 @@
 
 class BoxMovementScript : public Script {
 public:
-    BoxMovementScript() : speed(1000.0f), transform(nullptr), physics(nullptr) {}
-
-    void start() override {
-        transform = entity.lock()->getComponent<TransformComponent>();
-        physics = entity.lock()->getComponent<PhysicsComponent>();
-    }
+    BoxMovementScript() : speed(1000.0f) {}
 
     void update(float deltaTime) override {
-        physics->applyForce(Vector2f(speed, 0.0f) * deltaTime);
+        getComponent<PhysicsComponent>()->applyForce(Vector2f(speed, 0.0f) * deltaTime);
     }
 
-    void onCollision(const std::shared_ptr<Entity>& other) override {
+    void onCollision(EntityId other) override {
         speed = 0;
-        physics->isAffectedByGravity = true;
+        getComponent<PhysicsComponent>()->isAffectedByGravity = true;
     }
 
     void setSpeed(float speed) {
@@ -29,8 +24,6 @@ public:
     }
 private:
     float speed;
-    std::shared_ptr<TransformComponent> transform;
-    std::shared_ptr<PhysicsComponent> physics;
 };
 
 class LevelOne : public Scene {
@@ -42,16 +35,19 @@ public:
         SDL_Color white = { 255, 255, 255, 255 };
         SDL_Color orange = { 255, 165, 0, 255 };
 
-        player = createPlayerPrefab();
+        // Mostly static boxes of very different sizes
+        setBroadphase(BroadphaseType::AABBTree);
+
+        player = createPlayerPrefab(GetWorld());
         SetCameraTarget(player);
 
-        auto box = Entity::create();
+        auto box = GetWorld().createEntity();
         box->addComponent<TransformComponent>(Vector2f(0, 0), 0.0f, Vector2f(2.0f, 2.0f));
         box->addComponent<SquareComponent>(a, white);
         box->addComponent<BoxColliderComponent>();
         box->addComponent<PhysicsComponent>(10.0f, false, true);
 
-        auto box2 = Entity::create();
+        auto box2 = GetWorld().createEntity();
         box2->name = "orange";
         box2->addComponent<TransformComponent>(Vector2f(620, 0), 0.0f, Vector2f(3.0f, 3.0f));
         box2->addComponent<SquareComponent>(a, orange);
@@ -60,20 +56,20 @@ public:
 
         box2->getComponent<BoxColliderComponent>()->setLayer(LayerTwo);
 
-        auto box3 = Entity::create();
+        auto box3 = GetWorld().createEntity();
         box3->addComponent<TransformComponent>(Vector2f(0, 460), 0.0f, Vector2f(2.0f, 2.0f));
         box3->addComponent<SquareComponent>(a, white);
         box3->addComponent<BoxColliderComponent>();
         box3->addComponent<PhysicsComponent>(10.f, false, true);
 
-        auto box4 = Entity::create();
+        auto box4 = GetWorld().createEntity();
         box4->addComponent<TransformComponent>(Vector2f(620, 460), 0.0f, Vector2f(20.0f, 20.0f));
         box4->addComponent<SquareComponent>(a, white);
         box4->addComponent<BoxColliderComponent>();
         box4->addComponent<PhysicsComponent>(10.f, false, true);
 
         SDL_Color blue = { 0, 0, 255, 255 };
-        auto box5 = Entity::create();
+        auto box5 = GetWorld().createEntity();
         box5->addComponent<TransformComponent>(Vector2f(120, 40), 0.0f, Vector2f(4.0f, 4.0f));
         box5->addComponent<SquareComponent>(a, blue);
         box5->addComponent<BoxColliderComponent>();
@@ -82,11 +78,12 @@ public:
         auto box5physics = box5->getComponent<PhysicsComponent>();
         auto box5BoxCollider = box5->getComponent<BoxColliderComponent>();
         auto box5ScriptComponent = box5->getComponent<ScriptComponent>();
+        box5physics->isFast = true;
 
         box5ScriptComponent->addScript(std::make_shared<BoxMovementScript>());
 
         SDL_Color red = { 255, 0, 0, 255 };
-        auto box6 = Entity::create();
+        auto box6 = GetWorld().createEntity();
         box6->addComponent<TransformComponent>(Vector2f(520, 40), 45.0f, Vector2f(2.0f, 2.0f));
         box6->addComponent<SquareComponent>(a, red);
         box6->addComponent<BoxColliderComponent>();
@@ -96,6 +93,7 @@ public:
         auto box6physics = box6->getComponent<PhysicsComponent>();
         auto box6BoxCollider = box6->getComponent<BoxColliderComponent>();
         auto box6ScriptComponent = box6->getComponent<ScriptComponent>();
+        box6physics->isFast = true;
 
         std::shared_ptr<BoxMovementScript> boxMovementScript = std::make_shared<BoxMovementScript>();
         boxMovementScript->setSpeed(-1500.0f);
@@ -113,20 +111,20 @@ public:
     void Load() override {
         setShouldCollide(LayerOne, LayerTwo, false);
 
-        player = createPlayerPrefab();
+        player = createPlayerPrefab(GetWorld());
         SetCameraTarget(player);
 
         Rectangle a = { 10, 10 };
         SDL_Color white = { 255, 255, 255, 255 };
         SDL_Color orange = { 255, 165, 0, 255 };
 
-        auto box = Entity::create();
+        auto box = GetWorld().createEntity();
         box->addComponent<TransformComponent>(Vector2f(0, 0), 0.0f, Vector2f(2.0f, 2.0f));
         box->addComponent<SquareComponent>(a, white);
         box->addComponent<BoxColliderComponent>();
         box->addComponent<PhysicsComponent>(10.0f, false, true);
 
-        auto box2 = Entity::create();
+        auto box2 = GetWorld().createEntity();
         box2->name = "orange";
         box2->addComponent<TransformComponent>(Vector2f(620, 0), 0.0f, Vector2f(3.0f, 3.0f));
         box2->addComponent<SquareComponent>(a, orange);
@@ -135,20 +133,20 @@ public:
 
         box2->getComponent<BoxColliderComponent>()->setLayer(LayerTwo);
 
-        auto box3 = Entity::create();
+        auto box3 = GetWorld().createEntity();
         box3->addComponent<TransformComponent>(Vector2f(0, 460), 0.0f, Vector2f(2.0f, 2.0f));
         box3->addComponent<SquareComponent>(a, white);
         box3->addComponent<BoxColliderComponent>();
         box3->addComponent<PhysicsComponent>(10.f, false, true);
 
-        auto box4 = Entity::create();
+        auto box4 = GetWorld().createEntity();
         box4->addComponent<TransformComponent>(Vector2f(620, 460), 0.0f, Vector2f(20.0f, 20.0f));
         box4->addComponent<SquareComponent>(a, white);
         box4->addComponent<BoxColliderComponent>();
         box4->addComponent<PhysicsComponent>(10.f, false, true);
 
         SDL_Color blue = { 0, 0, 255, 255 };
-        auto box5 = Entity::create();
+        auto box5 = GetWorld().createEntity();
         box5->addComponent<TransformComponent>(Vector2f(120, 40), 0.0f, Vector2f(4.0f, 4.0f));
         box5->addComponent<SquareComponent>(a, blue);
         box5->addComponent<BoxColliderComponent>();
@@ -157,11 +155,12 @@ public:
         auto box5physics = box5->getComponent<PhysicsComponent>();
         auto box5BoxCollider = box5->getComponent<BoxColliderComponent>();
         auto box5ScriptComponent = box5->getComponent<ScriptComponent>();
+        box5physics->isFast = true;
 
         box5ScriptComponent->addScript(std::make_shared<BoxMovementScript>());
 
         SDL_Color red = { 255, 0, 0, 255 };
-        auto box6 = Entity::create();
+        auto box6 = GetWorld().createEntity();
         box6->addComponent<TransformComponent>(Vector2f(520, 40), 45.0f, Vector2f(2.0f, 2.0f));
         box6->addComponent<SquareComponent>(a, red);
         box6->addComponent<BoxColliderComponent>();
@@ -171,6 +170,7 @@ public:
         auto box6physics = box6->getComponent<PhysicsComponent>();
         auto box6BoxCollider = box6->getComponent<BoxColliderComponent>();
         auto box6ScriptComponent = box6->getComponent<ScriptComponent>();
+        box6physics->isFast = true;
 
         std::shared_ptr<BoxMovementScript> boxMovementScript = std::make_shared<BoxMovementScript>();
         boxMovementScript->setSpeed(-1500.0f);
@@ -5,6 +5,23 @@
 #include <ostream>
 #include <cassert>
 #include <initializer_list>
+#include <cstddef>
+#include <vector>
+
+// Instruction sets the batch kernels below may use. x64 always has SSE2; AVX2 has to be enabled
+// by the compiler (/arch:AVX2, -mavx2).
+#if defined(__AVX2__)
+#define PC_SIMD_AVX2 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PC_SIMD_SSE2 1
+#endif
+
+#if defined(PC_SIMD_AVX2)
+#include <immintrin.h>
+#elif defined(PC_SIMD_SSE2)
+#include <emmintrin.h>
+#endif
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -613,6 +630,99 @@ namespace PC {
 	using Matrix3x3int = Matrix3x3<int>;
 	using Matrix3x3f = Matrix3x3<float>;
 
+	// 2D affine transform stored as the top two rows of a 3x3 matrix:
+	// | a  b  tx |
+	// | c  d  ty |
+	// The bottom row is always 0 0 1, so composing two of them takes 12 mul-adds instead of 27.
+	template <typename T>
+	struct Affine2D {
+		T a, b, c, d;
+		T tx, ty;
+
+		Affine2D()
+			: a(1), b(0), c(0), d(1), tx(0), ty(0)
+		{}
+
+		Affine2D(T a, T b, T c, T d, T tx, T ty)
+			: a(a), b(b), c(c), d(d), tx(tx), ty(ty)
+		{}
+
+		explicit Affine2D(const Matrix3x3<T>& m)
+			: a(m.matrix[0][0]), b(m.matrix[0][1]), c(m.matrix[1][0]), d(m.matrix[1][1]), tx(m.matrix[0][2]), ty(m.matrix[1][2])
+		{}
+
+		// Translation * rotation * scale, from a rotation whose cosine and sine are already known
+		static Affine2D fromTRS(const Vector2<T>& translation, T cosTheta, T sinTheta, const Vector2<T>& scale) {
+			return Affine2D(cosTheta * scale.x, -sinTheta * scale.y,
+				sinTheta * scale.x, cosTheta * scale.y,
+				translation.x, translation.y);
+		}
+
+		// Translation * rotation * scale, rotation in degrees
+		static Affine2D fromTRS(const Vector2<T>& translation, T rotationAngle, const Vector2<T>& scale) {
+			T radians = static_cast<T>(rotationAngle * M_PI / 180.0f);
+			return fromTRS(translation, static_cast<T>(cos(radians)), static_cast<T>(sin(radians)), scale);
+		}
+
+		Affine2D operator*(const Affine2D& m) const {
+			return Affine2D(a * m.a + b * m.c, a * m.b + b * m.d,
+				c * m.a + d * m.c, c * m.b + d * m.d,
+				a * m.tx + b * m.ty + tx, c * m.tx + d * m.ty + ty);
+		}
+
+		Vector2<T> operator*(const Vector2<T>& v) const {
+			return Vector2<T>(a * v.x + b * v.y + tx, c * v.x + d * v.y + ty);
+		}
+
+		bool operator==(const Affine2D& other) const {
+			return a == other.a && b == other.b && c == other.c && d == other.d && tx == other.tx && ty == other.ty;
+		}
+
+		bool operator!=(const Affine2D& other) const {
+			return !(*this == other);
+		}
+
+		// Element-wise blend, t = 0 giving from. Close enough for the small steps between two
+		// frames; over large rotations the blend shrinks a little halfway.
+		static Affine2D lerp(const Affine2D& from, const Affine2D& to, T t) {
+			return Affine2D(from.a + (to.a - from.a) * t, from.b + (to.b - from.b) * t,
+				from.c + (to.c - from.c) * t, from.d + (to.d - from.d) * t,
+				from.tx + (to.tx - from.tx) * t, from.ty + (to.ty - from.ty) * t);
+		}
+
+		// Assumes the transform is invertible, i.e. no zero scale
+		Affine2D inverse() const {
+			T invDet = 1 / (a * d - b * c);
+			T ia = d * invDet, ib = -b * invDet;
+			T ic = -c * invDet, id = a * invDet;
+			return Affine2D(ia, ib, ic, id, -(ia * tx + ib * ty), -(ic * tx + id * ty));
+		}
+
+		Matrix3x3<T> toMatrix3x3() const {
+			return Matrix3x3<T>({ { a, b, tx }, { c, d, ty }, { 0, 0, 1 } });
+		}
+
+		Vector2<T> getTranslation() const {
+			return Vector2<T>(tx, ty);
+		}
+
+		Vector2<T> getScale() const {
+			return Vector2<T>(std::sqrt(a * a + c * c), std::sqrt(b * b + d * d));
+		}
+
+		float getRotation() const {
+			float rotation = std::atan2(c, a);
+			return static_cast<float>(rotation * 180.0f / M_PI);  // Convert to degrees
+		}
+
+		friend std::ostream& operator<<(std::ostream& os, const Affine2D& m) {
+			os << m.a << " " << m.b << " " << m.tx << " \n" << m.c << " " << m.d << " " << m.ty << " \n";
+			return os;
+		}
+	};
+
+	using Affine2Df = Affine2D<float>;
+
 	template <typename T>
 	struct Matrix4x4 {
 	private:
@@ -940,4 +1050,310 @@ namespace PC {
 
 	using Matrix4x4int = Matrix4x4<int>;
 	using Matrix4x4f = Matrix4x4<float>;
+
+	// Batch kernels over many points or matrices at once. Points are passed structure-of-arrays
+	// (separate x and y arrays) so a register holds the same coordinate of 4 (SSE2) or 8 (AVX2)
+	// points. Every kernel has a scalar path that handles the remainder and non-x86 targets, and
+	// gives the same results as the scalar Vector2/Affine2D operators. Output arrays may alias the
+	// inputs.
+	namespace Batch {
+		static_assert(sizeof(Affine2Df) == 6 * sizeof(float), "Affine2Df must be six packed floats");
+
+		// Lane types for writing a kernel once and running it 1, 4 or 8 wide. Every operation rounds
+		// exactly like its scalar counterpart, so a value comes out the same whichever width computed
+		// it. min and max follow the SSE rule, (a < b) ? a : b.
+		struct ScalarLanes {
+			static constexpr size_t Width = 1;
+			using Value = float;
+			using Mask = bool;
+
+			static Value load(const float* p) { return *p; }
+			static void store(float* p, Value v) { *p = v; }
+			static Value broadcast(float f) { return f; }
+			static Value add(Value a, Value b) { return a + b; }
+			static Value sub(Value a, Value b) { return a - b; }
+			static Value mul(Value a, Value b) { return a * b; }
+			static Value negate(Value a) { return -a; }
+			static Value sqrt(Value a) { return std::sqrt(a); }
+			static Value min(Value a, Value b) { return a < b ? a : b; }
+			static Value max(Value a, Value b) { return a > b ? a : b; }
+			static Mask less(Value a, Value b) { return a < b; }
+			static Mask lessEqual(Value a, Value b) { return a <= b; }
+			static Mask either(Mask a, Mask b) { return a || b; }
+			static Mask none() { return false; }
+			static Value select(Mask m, Value a, Value b) { return m ? a : b; }
+			static bool all(Mask m) { return m; }
+			static int bits(Mask m) { return m ? 1 : 0; } // One bit per lane
+		};
+
+#if defined(PC_SIMD_SSE2)
+		struct SSELanes {
+			static constexpr size_t Width = 4;
+			using Value = __m128;
+			using Mask = __m128;
+
+			static Value load(const float* p) { return _mm_loadu_ps(p); }
+			static void store(float* p, Value v) { _mm_storeu_ps(p, v); }
+			static Value broadcast(float f) { return _mm_set1_ps(f); }
+			static Value add(Value a, Value b) { return _mm_add_ps(a, b); }
+			static Value sub(Value a, Value b) { return _mm_sub_ps(a, b); }
+			static Value mul(Value a, Value b) { return _mm_mul_ps(a, b); }
+			static Value negate(Value a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+			static Value sqrt(Value a) { return _mm_sqrt_ps(a); }
+			static Value min(Value a, Value b) { return _mm_min_ps(a, b); }
+			static Value max(Value a, Value b) { return _mm_max_ps(a, b); }
+			static Mask less(Value a, Value b) { return _mm_cmplt_ps(a, b); }
+			static Mask lessEqual(Value a, Value b) { return _mm_cmple_ps(a, b); }
+			static Mask either(Mask a, Mask b) { return _mm_or_ps(a, b); }
+			static Mask none() { return _mm_setzero_ps(); }
+			static Value select(Mask m, Value a, Value b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+			static bool all(Mask m) { return _mm_movemask_ps(m) == 0xF; }
+			static int bits(Mask m) { return _mm_movemask_ps(m); }
+		};
+#endif
+
+#if defined(PC_SIMD_AVX2)
+		struct AVXLanes {
+			static constexpr size_t Width = 8;
+			using Value = __m256;
+			using Mask = __m256;
+
+			static Value load(const float* p) { return _mm256_loadu_ps(p); }
+			static void store(float* p, Value v) { _mm256_storeu_ps(p, v); }
+			static Value broadcast(float f) { return _mm256_set1_ps(f); }
+			static Value add(Value a, Value b) { return _mm256_add_ps(a, b); }
+			static Value sub(Value a, Value b) { return _mm256_sub_ps(a, b); }
+			static Value mul(Value a, Value b) { return _mm256_mul_ps(a, b); }
+			static Value negate(Value a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+			static Value sqrt(Value a) { return _mm256_sqrt_ps(a); }
+			static Value min(Value a, Value b) { return _mm256_min_ps(a, b); }
+			static Value max(Value a, Value b) { return _mm256_max_ps(a, b); }
+			static Mask less(Value a, Value b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+			static Mask lessEqual(Value a, Value b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+			static Mask either(Mask a, Mask b) { return _mm256_or_ps(a, b); }
+			static Mask none() { return _mm256_setzero_ps(); }
+			static Value select(Mask m, Value a, Value b) { return _mm256_blendv_ps(b, a, m); }
+			static bool all(Mask m) { return _mm256_movemask_ps(m) == 0xFF; }
+			static int bits(Mask m) { return _mm256_movemask_ps(m); }
+		};
+
+		using WideLanes = AVXLanes;
+#elif defined(PC_SIMD_SSE2)
+		using WideLanes = SSELanes;
+#else
+		using WideLanes = ScalarLanes;
+#endif
+
+		// Widest lanes no wider than four, for the four corners of a box
+#if defined(PC_SIMD_SSE2)
+		using QuadLanes = SSELanes;
+#else
+		using QuadLanes = ScalarLanes;
+#endif
+
+		// The kernels take the lanes to run on, WideLanes unless told otherwise, and finish whatever
+		// is left over one value at a time.
+
+		// out = m * (x, y) for every point
+		template <typename L = WideLanes>
+		inline void transformPoints(const Affine2Df& m, const float* xs, const float* ys, float* outX, float* outY, size_t count) {
+			using V = typename L::Value;
+			V a = L::broadcast(m.a), b = L::broadcast(m.b), tx = L::broadcast(m.tx);
+			V c = L::broadcast(m.c), d = L::broadcast(m.d), ty = L::broadcast(m.ty);
+			size_t i = 0;
+			for (; i + L::Width <= count; i += L::Width) {
+				V x = L::load(xs + i);
+				V y = L::load(ys + i);
+				L::store(outX + i, L::add(L::add(L::mul(a, x), L::mul(b, y)), tx));
+				L::store(outY + i, L::add(L::add(L::mul(c, x), L::mul(d, y)), ty));
+			}
+			if constexpr (L::Width > 1) {
+				transformPoints<ScalarLanes>(m, xs + i, ys + i, outX + i, outY + i, count - i);
+			}
+		}
+
+		// Affines held structure-of-arrays: matrix i is (a[i], b[i], c[i], d[i], tx[i], ty[i]), so a
+		// register holds the same element of 4 (SSE2) or 8 (AVX2) matrices
+		struct AffineArrays {
+			float* a;
+			float* b;
+			float* c;
+			float* d;
+			float* tx;
+			float* ty;
+
+			AffineArrays offset(size_t i) const {
+				return { a + i, b + i, c + i, d + i, tx + i, ty + i };
+			}
+		};
+
+		// Owns the arrays for a number of structure-of-arrays affines. Values are not kept across a resize.
+		class AffineBuffer {
+		public:
+			void resize(size_t count) {
+				elements.resize(count * 6);
+				this->count = count;
+			}
+
+			size_t size() const {
+				return count;
+			}
+
+			void set(size_t i, const Affine2Df& m) {
+				float* e = elements.data();
+				e[i] = m.a;
+				e[count + i] = m.b;
+				e[2 * count + i] = m.c;
+				e[3 * count + i] = m.d;
+				e[4 * count + i] = m.tx;
+				e[5 * count + i] = m.ty;
+			}
+
+			Affine2Df get(size_t i) const {
+				const float* e = elements.data();
+				return Affine2Df(e[i], e[count + i], e[2 * count + i], e[3 * count + i], e[4 * count + i], e[5 * count + i]);
+			}
+
+			AffineArrays arrays() {
+				float* e = elements.data();
+				return { e, e + count, e + 2 * count, e + 3 * count, e + 4 * count, e + 5 * count };
+			}
+
+		private:
+			std::vector<float> elements; // The six arrays one after the other
+			size_t count = 0;
+		};
+
+		// The products of L::Width matrices starting at i, in the same operations as Affine2D's
+		// operator*. Every input is loaded before anything is stored, so out may alias rhs.
+		template <typename L>
+		inline void multiplyAffineLanes(typename L::Value la, typename L::Value lb, typename L::Value lc, typename L::Value ld,
+			typename L::Value ltx, typename L::Value lty, const AffineArrays& rhs, const AffineArrays& out, size_t i) {
+			using V = typename L::Value;
+			V a = L::load(rhs.a + i), b = L::load(rhs.b + i), c = L::load(rhs.c + i), d = L::load(rhs.d + i);
+			V tx = L::load(rhs.tx + i), ty = L::load(rhs.ty + i);
+			L::store(out.a + i, L::add(L::mul(la, a), L::mul(lb, c)));
+			L::store(out.b + i, L::add(L::mul(la, b), L::mul(lb, d)));
+			L::store(out.c + i, L::add(L::mul(lc, a), L::mul(ld, c)));
+			L::store(out.d + i, L::add(L::mul(lc, b), L::mul(ld, d)));
+			L::store(out.tx + i, L::add(L::add(L::mul(la, tx), L::mul(lb, ty)), ltx));
+			L::store(out.ty + i, L::add(L::add(L::mul(lc, tx), L::mul(ld, ty)), lty));
+		}
+
+		// out[i] = lhs * rhs[i] on structure-of-arrays affines, e.g. the camera times every global
+		// transform, L::Width products at a time
+		template <typename L = WideLanes>
+		inline void multiplyAffines(const Affine2Df& lhs, const AffineArrays& rhs, const AffineArrays& out, size_t count) {
+			using V = typename L::Value;
+			V la = L::broadcast(lhs.a), lb = L::broadcast(lhs.b), ltx = L::broadcast(lhs.tx);
+			V lc = L::broadcast(lhs.c), ld = L::broadcast(lhs.d), lty = L::broadcast(lhs.ty);
+			size_t i = 0;
+			for (; i + L::Width <= count; i += L::Width) {
+				multiplyAffineLanes<L>(la, lb, lc, ld, ltx, lty, rhs, out, i);
+			}
+			if constexpr (L::Width > 1) {
+				multiplyAffines<ScalarLanes>(lhs, rhs.offset(i), out.offset(i), count - i);
+			}
+		}
+
+		// out[i] = lhs[i] * rhs[i] on structure-of-arrays affines. out may alias lhs or rhs.
+		template <typename L = WideLanes>
+		inline void multiplyAffines(const AffineArrays& lhs, const AffineArrays& rhs, const AffineArrays& out, size_t count) {
+			size_t i = 0;
+			for (; i + L::Width <= count; i += L::Width) {
+				multiplyAffineLanes<L>(L::load(lhs.a + i), L::load(lhs.b + i), L::load(lhs.c + i), L::load(lhs.d + i),
+					L::load(lhs.tx + i), L::load(lhs.ty + i), rhs, out, i);
+			}
+			if constexpr (L::Width > 1) {
+				multiplyAffines<ScalarLanes>(lhs.offset(i), rhs.offset(i), out.offset(i), count - i);
+			}
+		}
+
+#if defined(PC_SIMD_SSE2)
+		// One product: the 2x2 part is two 4-wide mul-adds, the translation one more
+		inline void multiplyAffineSSE(const Affine2Df& l, const Affine2Df& rhs, Affine2Df& out) {
+			const float* r = &rhs.a;
+			__m128 rLinear = _mm_loadu_ps(r); // a b c d
+			__m128 rRow0 = _mm_shuffle_ps(rLinear, rLinear, _MM_SHUFFLE(1, 0, 1, 0)); // a b a b
+			__m128 rRow1 = _mm_shuffle_ps(rLinear, rLinear, _MM_SHUFFLE(3, 2, 3, 2)); // c d c d
+			__m128 linear = _mm_add_ps(_mm_mul_ps(_mm_setr_ps(l.a, l.a, l.c, l.c), rRow0),
+				_mm_mul_ps(_mm_setr_ps(l.b, l.b, l.d, l.d), rRow1));
+			__m128 translation = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(_mm_setr_ps(l.a, l.c, 0.0f, 0.0f), _mm_set1_ps(r[4])),
+				_mm_mul_ps(_mm_setr_ps(l.b, l.d, 0.0f, 0.0f), _mm_set1_ps(r[5]))),
+				_mm_setr_ps(l.tx, l.ty, 0.0f, 0.0f));
+			float* o = &out.a;
+			_mm_storeu_ps(o, linear);
+			_mm_storel_pi(reinterpret_cast<__m64*>(o + 4), translation);
+		}
+#endif
+
+		// out[i] = lhs[i] * rhs[i] on packed affines. A product fits in one SSE register, so wider
+		// lanes run it 4 wide; the structure-of-arrays overloads run the full lane width.
+		template <typename L = WideLanes>
+		inline void multiplyAffines(const Affine2Df* lhs, const Affine2Df* rhs, Affine2Df* out, size_t count) {
+			for (size_t i = 0; i < count; i++) {
+#if defined(PC_SIMD_SSE2)
+				if constexpr (L::Width >= 4) {
+					multiplyAffineSSE(Affine2Df(lhs[i]), rhs[i], out[i]);
+					continue;
+				}
+#endif
+				out[i] = lhs[i] * rhs[i];
+			}
+		}
+
+		// out[i] = lhs * rhs[i], e.g. the camera times every local transform
+		template <typename L = WideLanes>
+		inline void multiplyAffines(const Affine2Df& lhs, const Affine2Df* rhs, Affine2Df* out, size_t count) {
+			const Affine2Df l = lhs; // lhs may itself be one of the outputs
+			for (size_t i = 0; i < count; i++) {
+#if defined(PC_SIMD_SSE2)
+				if constexpr (L::Width >= 4) {
+					multiplyAffineSSE(l, rhs[i], out[i]);
+					continue;
+				}
+#endif
+				out[i] = l * rhs[i];
+			}
+		}
+
+		// out[i] = (ax[i], ay[i]) . (bx[i], by[i])
+		template <typename L = WideLanes>
+		inline void dotProducts(const float* ax, const float* ay, const float* bx, const float* by, float* out, size_t count) {
+			size_t i = 0;
+			for (; i + L::Width <= count; i += L::Width) {
+				L::store(out + i, L::add(L::mul(L::load(ax + i), L::load(bx + i)), L::mul(L::load(ay + i), L::load(by + i))));
+			}
+			if constexpr (L::Width > 1) {
+				dotProducts<ScalarLanes>(ax + i, ay + i, bx + i, by + i, out + i, count - i);
+			}
+		}
+
+		// out[i] = (axis.x, axis.y) . (xs[i], ys[i]), projecting every point onto one axis
+		template <typename L = WideLanes>
+		inline void dotProducts(const Vector2<float>& axis, const float* xs, const float* ys, float* out, size_t count) {
+			typename L::Value axisX = L::broadcast(axis.x), axisY = L::broadcast(axis.y);
+			size_t i = 0;
+			for (; i + L::Width <= count; i += L::Width) {
+				L::store(out + i, L::add(L::mul(axisX, L::load(xs + i)), L::mul(axisY, L::load(ys + i))));
+			}
+			if constexpr (L::Width > 1) {
+				dotProducts<ScalarLanes>(axis, xs + i, ys + i, out + i, count - i);
+			}
+		}
+
+		// out[i] = |(xs[i], ys[i])|
+		template <typename L = WideLanes>
+		inline void magnitudes(const float* xs, const float* ys, float* out, size_t count) {
+			size_t i = 0;
+			for (; i + L::Width <= count; i += L::Width) {
+				typename L::Value x = L::load(xs + i), y = L::load(ys + i);
+				L::store(out + i, L::sqrt(L::add(L::mul(x, x), L::mul(y, y))));
+			}
+			if constexpr (L::Width > 1) {
+				magnitudes<ScalarLanes>(xs + i, ys + i, out + i, count - i);
+			}
+		}
+	}
 }
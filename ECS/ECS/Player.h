@@ -9,14 +9,8 @@ using namespace PC;
 
 class PlayerAnimationScript : public Script {
 public:
-    PlayerAnimationScript()
-        : velocity(nullptr), transform(nullptr), sprite(nullptr) {
-    }
-
     void start() override {
-        velocity = entity.lock()->getComponent<VelocityComponent>();
-        transform = entity.lock()->getComponent<TransformComponent>();
-        sprite = entity.lock()->getComponent<SpriteComponent>();
+        auto sprite = getComponent<SpriteComponent>();
 
         sprite->addAnimationState("idleFront", AnimationState(6 * 0, 6, 125));
         sprite->addAnimationState("idleRight", AnimationState(6 * 1, 6, 125));
@@ -36,6 +30,9 @@ public:
     }
 
     void update(float deltaTime) override {
+        auto velocity = getComponent<VelocityComponent>();
+        auto sprite = getComponent<SpriteComponent>();
+
         if (velocity->dx > 0) {
             // Moving right
             sprite->setAnimationState(!sprite->animationPlaying && sprite->currentState == "attackingRight" ? "idleRight" : "walkingRight");
@@ -67,43 +64,26 @@ public:
             }
         }
     }
-
-private:
-    std::shared_ptr<VelocityComponent> velocity;
-    std::shared_ptr<TransformComponent> transform;
-    std::shared_ptr<SpriteComponent> sprite;
 };
 
 class PlayerMovementScript : public Script {
 public:
-    PlayerMovementScript() : velocity(nullptr), transform(nullptr) {}
-
-    void start() override {
-        velocity = entity.lock()->getComponent<VelocityComponent>();
-        transform = entity.lock()->getComponent<TransformComponent>();
-    }
-
     void update(float deltaTime) override {
+        auto velocity = getComponent<VelocityComponent>();
+        auto transform = getComponent<TransformComponent>();
+
         transform->setPosition({ transform->getPosition().x + velocity->dx * deltaTime,
                                 transform->getPosition().y + velocity->dy * deltaTime });
 
     }
-private:
-    std::shared_ptr<VelocityComponent> velocity;
-    std::shared_ptr<TransformComponent> transform;
 };
 
 class PlayerInputScript : public Script {
 public:
-    PlayerInputScript() : velocity(nullptr), transform(nullptr), sprite(nullptr) {}
-
-    void start() override {
-        velocity = entity.lock()->getComponent<VelocityComponent>();
-        transform = entity.lock()->getComponent<TransformComponent>();
-        sprite = entity.lock()->getComponent<SpriteComponent>();
-    }
-
     void update(float deltaTime) override {       
+        auto velocity = getComponent<VelocityComponent>();
+        auto sprite = getComponent<SpriteComponent>();
+
         if (InputSystem::isKeyDown(SDLK_SPACE)) {
             SceneManager::SwitchScene("LevelTwo");
         }
@@ -157,30 +137,28 @@ public:
 
         
     }
-private:
-    std::shared_ptr<VelocityComponent> velocity;
-    std::shared_ptr<TransformComponent> transform;
-    std::shared_ptr<SpriteComponent> sprite;
 };
 
 class PlayerCollisionScript : public Script {
 public:
-    void onCollisionExit(const std::shared_ptr<Entity>& other) override {
-        if (other->name == "orange") {
+    void onCollisionExit(EntityId other) override {
+        Entity* otherEntity = getWorld()->getEntity(other);
+        if (otherEntity && otherEntity->name == "orange") {
             std::cout << "collision with orange ended" << std::endl;
         }
     }
 
-    void onCollision(const std::shared_ptr<Entity>& other) override {
-        if (other->name == "orange") {
+    void onCollision(EntityId other) override {
+        Entity* otherEntity = getWorld()->getEntity(other);
+        if (otherEntity && otherEntity->name == "orange") {
             std::cout << "collision with orange" << std::endl;
         }
     }
 };
 
-std::shared_ptr<Entity> createPlayerPrefab() {
+std::shared_ptr<Entity> createPlayerPrefab(World& world) {
     // Create a new entity
-    std::shared_ptr<Entity> player = Entity::create();
+    std::shared_ptr<Entity> player = world.createEntity();
 
     // Add necessary components
     player->addComponent<TransformComponent>(Vector2f(320, 140), 0.0f, Vector2f(3.f, 3.f));
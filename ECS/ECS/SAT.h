@@ -0,0 +1,193 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include "PCM.h"
+#include "Broadphase.h"
+
+struct OBB {
+    PC::Vector2f center;
+    PC::Vector2f extents;
+    PC::Matrix3x3f rotationMatrix;
+
+    OBB() = default;
+    OBB(const PC::Vector2f& center, const PC::Vector2f& extents, const PC::Matrix3x3f& rotationMatrix)
+        : center(center), extents(extents), rotationMatrix(rotationMatrix) { }
+
+    // Smallest axis-aligned box around the rotated corners
+    AABB getBounds() const {
+        PC::Vector2f half(std::abs(rotationMatrix.GetValue(0, 0)) * extents.x + std::abs(rotationMatrix.GetValue(0, 1)) * extents.y,
+            std::abs(rotationMatrix.GetValue(1, 0)) * extents.x + std::abs(rotationMatrix.GetValue(1, 1)) * extents.y);
+        return AABB(center - half, center + half);
+    }
+
+    void getVertices(PC::Vector2f vertices[4]) const {
+        vertices[0] = center + (rotationMatrix * (extents * PC::Vector2f(1, 1)));
+        vertices[1] = center + (rotationMatrix * (extents * PC::Vector2f(1, -1)));
+        vertices[2] = center + (rotationMatrix * (extents * PC::Vector2f(-1, -1)));
+        vertices[3] = center + (rotationMatrix * (extents * PC::Vector2f(-1, 1)));
+    }
+};
+
+// Corners and edge normals of an OBB, worked out once per frame so every SAT test against the box
+// reuses them
+struct OBBShape {
+    PC::Vector2f vertices[4];
+    PC::Vector2f axes[2];
+
+    OBBShape() = default;
+
+    explicit OBBShape(const OBB& obb) {
+        // The same corners as OBB::getVertices, all four put through the box's affine in one go
+        const PC::Matrix3x3f& r = obb.rotationMatrix;
+        PC::Affine2Df box(r.GetValue(0, 0), r.GetValue(0, 1), r.GetValue(1, 0), r.GetValue(1, 1), obb.center.x, obb.center.y);
+        float cornerX[4] = { obb.extents.x, obb.extents.x, -obb.extents.x, -obb.extents.x };
+        float cornerY[4] = { obb.extents.y, -obb.extents.y, -obb.extents.y, obb.extents.y };
+        float x[4], y[4];
+        PC::Batch::transformPoints<PC::Batch::QuadLanes>(box, cornerX, cornerY, x, y, 4);
+        for (int i = 0; i < 4; i++) {
+            vertices[i] = PC::Vector2f(x[i], y[i]);
+        }
+
+        // Normals of the edges from vertex 0 to 1 and from vertex 0 to 3
+        PC::Vector2f edges[2] = { vertices[1] - vertices[0], vertices[3] - vertices[0] };
+        for (int i = 0; i < 2; i++) {
+            axes[i] = PC::Vector2f(-edges[i].y, edges[i].x).normalize();
+        }
+    }
+
+    void projectOntoAxis(const PC::Vector2f& axis, float& min, float& max) const {
+        min = max = axis.dotProduct(vertices[0]);
+
+        for (int i = 1; i < 4; i++) {
+            float projection = axis.dotProduct(vertices[i]);
+
+            if (projection < min) min = projection;
+            else if (projection > max) max = projection;
+        }
+    }
+};
+
+// Overlapping pair found by the SAT, with the translation that separates it
+struct SATHit {
+    uint32_t pair; // Index into the tested pair list
+    PC::Vector2f mtv;
+};
+
+// Separating axis test for many OBB pairs at once. The pairs' corners and axes are gathered into
+// structure-of-arrays lanes, one pair per lane, and 4 (SSE2) or 8 (AVX2) pairs are tested against
+// their four axes together. The lane kernel performs exactly the scalar operations, so a pair gets
+// the same result whether it went through a wide block or the scalar remainder.
+class BatchSAT {
+public:
+    // Tests the pairs of shapes, appending the overlapping ones in pair order
+    void run(const OBBShape* shapes, const ProxyPair* pairs, size_t count, std::vector<SATHit>& hits) {
+        size_t i = 0;
+        for (; i + Wide::Width <= count; i += Wide::Width) {
+            testBlock<Wide>(shapes, pairs, i, hits);
+        }
+        for (; i < count; i++) {
+            testBlock<PC::Batch::ScalarLanes>(shapes, pairs, i, hits);
+        }
+    }
+
+    // A single pair. On overlap, mtv is the smallest translation that separates them, pointing
+    // from A to B.
+    static bool test(const OBBShape& shapeA, const OBBShape& shapeB, PC::Vector2f& mtv) {
+        Lanes block;
+        block.gather(0, shapeA, shapeB);
+        if (!block.test<PC::Batch::ScalarLanes>()) {
+            return false;
+        }
+        mtv = PC::Vector2f(block.mtvX[0], block.mtvY[0]);
+        return true;
+    }
+
+private:
+    using Wide = PC::Batch::WideLanes;
+    static constexpr size_t MaxWidth = 8;
+
+    struct Lanes {
+        float vertexAX[4][MaxWidth], vertexAY[4][MaxWidth];
+        float vertexBX[4][MaxWidth], vertexBY[4][MaxWidth];
+        float axisX[4][MaxWidth], axisY[4][MaxWidth];
+        float mtvX[MaxWidth], mtvY[MaxWidth];
+
+        void gather(size_t lane, const OBBShape& a, const OBBShape& b) {
+            for (int i = 0; i < 4; i++) {
+                vertexAX[i][lane] = a.vertices[i].x;
+                vertexAY[i][lane] = a.vertices[i].y;
+                vertexBX[i][lane] = b.vertices[i].x;
+                vertexBY[i][lane] = b.vertices[i].y;
+            }
+            const PC::Vector2f* axes[4] = { &a.axes[0], &a.axes[1], &b.axes[0], &b.axes[1] };
+            for (int i = 0; i < 4; i++) {
+                axisX[i][lane] = axes[i]->x;
+                axisY[i][lane] = axes[i]->y;
+            }
+        }
+
+        // Returns one bit per overlapping lane and fills in their MTVs
+        template <typename L>
+        int test() {
+            using V = typename L::Value;
+            V minOverlap = L::broadcast(std::numeric_limits<float>::max());
+            V resultX = L::broadcast(0.0f), resultY = L::broadcast(0.0f);
+            typename L::Mask separated = L::none();
+
+            for (int k = 0; k < 4; k++) {
+                V x = L::load(axisX[k]), y = L::load(axisY[k]);
+                V minA, maxA, minB, maxB;
+                project<L>(x, y, vertexAX, vertexAY, minA, maxA);
+                project<L>(x, y, vertexBX, vertexBY, minB, maxB);
+
+                V overlap = L::sub(L::min(maxA, maxB), L::max(minA, minB));
+                separated = L::either(separated, L::lessEqual(overlap, L::broadcast(0.0f)));
+                if (L::all(separated)) {
+                    return 0;
+                }
+
+                // Lanes already separated carry on, their result is dropped
+                typename L::Mask better = L::less(overlap, minOverlap);
+                typename L::Mask flip = L::less(L::sub(maxB, minA), L::sub(maxA, minB));
+                minOverlap = L::select(better, overlap, minOverlap);
+                V mtvX = L::mul(L::select(flip, L::negate(x), x), overlap);
+                V mtvY = L::mul(L::select(flip, L::negate(y), y), overlap);
+                resultX = L::select(better, mtvX, resultX);
+                resultY = L::select(better, mtvY, resultY);
+            }
+
+            L::store(mtvX, resultX);
+            L::store(mtvY, resultY);
+            return ~L::bits(separated) & ((1 << L::Width) - 1);
+        }
+
+        template <typename L>
+        static void project(typename L::Value x, typename L::Value y, const float (*vx)[MaxWidth], const float (*vy)[MaxWidth],
+            typename L::Value& min, typename L::Value& max) {
+            min = max = L::add(L::mul(x, L::load(vx[0])), L::mul(y, L::load(vy[0])));
+            for (int i = 1; i < 4; i++) {
+                typename L::Value projection = L::add(L::mul(x, L::load(vx[i])), L::mul(y, L::load(vy[i])));
+                min = L::min(min, projection);
+                max = L::max(max, projection);
+            }
+        }
+    };
+
+    template <typename L>
+    void testBlock(const OBBShape* shapes, const ProxyPair* pairs, size_t first, std::vector<SATHit>& hits) {
+        for (size_t lane = 0; lane < L::Width; lane++) {
+            const ProxyPair& pair = pairs[first + lane];
+            lanes.gather(lane, shapes[pair.first], shapes[pair.second]);
+        }
+        int overlapping = lanes.test<L>();
+        for (size_t lane = 0; lane < L::Width; lane++) {
+            if (overlapping & (1 << lane)) {
+                hits.push_back({ static_cast<uint32_t>(first + lane), PC::Vector2f(lanes.mtvX[lane], lanes.mtvY[lane]) });
+            }
+        }
+    }
+
+    Lanes lanes;
+};
@@ -1,21 +1,31 @@
 #include "Scene.h"
 #include <iostream>
+#include <cmath>
 
 void SceneManager::SwitchScene(const std::string& sceneName) {
-    if (currentScene) {
-        currentScene->Unload();
+    if (scenes.find(sceneName) == scenes.end()) {
+        std::cerr << "Scene " << sceneName << " not found!" << std::endl;
+        return;
     }
 
-    auto it = scenes.find(sceneName);
-    if (it == scenes.end()) {
-        std::cerr << "Scene " << sceneName << " not found!" << std::endl;
+    // Unloading destroys the component storage, which may be what is calling us (a script), so
+    // while a scene is running the switch is applied once the current frame has finished
+    if (currentScene) {
+        pendingScene = sceneName;
         return;
     }
 
-    currentScene = it->second;
+    LoadScene(sceneName);
+}
+
+void SceneManager::LoadScene(const std::string& sceneName) {
+    if (currentScene) {
+        currentScene->Unload();
+    }
+
+    currentScene = scenes[sceneName];
     currentScene->Initialize();
     currentScene->Load();
-    currentScene->RegisterEntities();
 }
 
 void SceneManager::AddScene(std::shared_ptr<Scene> scene) {
@@ -27,6 +37,12 @@ void SceneManager::Run()
     if (currentScene) {
         currentScene->Run();
     }
+
+    if (!pendingScene.empty()) {
+        std::string sceneName = pendingScene;
+        pendingScene.clear();
+        LoadScene(sceneName);
+    }
 }
 
 std::string SceneManager::GetCurrentScene()
@@ -37,54 +53,87 @@ std::string SceneManager::GetCurrentScene()
     return "";
 }
 
+bool SceneManager::IsSwitchPending()
+{
+    return !pendingScene.empty();
+}
+
 Scene::Scene(const std::string& name, std::shared_ptr<Camera> cam) : sceneName(name), cam(std::make_shared<Camera>(*cam)),
-quitManager(QuitManager::getInstance()), deltaTime(0.0f), timer(nullptr), systemManager(nullptr), renderSystem(nullptr),
-worldSpaceSystem(nullptr), collisionSystem(nullptr), physicsSystem(nullptr), scriptSystem(nullptr), cameraTarget(nullptr)
+quitManager(QuitManager::getInstance()), deltaTime(0.0f), fixedTimeStep(1.0f / 60.0f), maxStepsPerFrame(5),
+accumulator(0.0f), timer(nullptr), world(nullptr), renderSystem(nullptr),
+worldSpaceSystem(nullptr), collisionSystem(nullptr), physicsSystem(nullptr), scriptSystem(nullptr)
 {
 }
 
 void Scene::Initialize()
 {
-    systemManager = std::make_unique<SystemManager>();
+    world = std::make_unique<World>();
+    SystemManager& systemManager = world->getSystemManager();
 
-    renderSystem = systemManager->registerSystem<RenderSystem>(true);
-    worldSpaceSystem = systemManager->registerSystem<WorldSpaceSystem>(cam);
-    collisionSystem = systemManager->registerSystem<CollisionSystem>();
-    physicsSystem = systemManager->registerSystem<PhysicsSystem>();
-    scriptSystem = systemManager->registerSystem<ScriptSystem>();
+    renderSystem = systemManager.registerSystem<RenderSystem>(true);
+    worldSpaceSystem = systemManager.registerSystem<WorldSpaceSystem>(cam);
+    collisionSystem = systemManager.registerSystem<CollisionSystem>();
+    collisionSystem->setWorkerThreads(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    physicsSystem = systemManager.registerSystem<PhysicsSystem>(collisionSystem);
+    scriptSystem = systemManager.registerSystem<ScriptSystem>();
 
     timer = std::make_unique<Timer>();
+    accumulator = 0.0f;
+    shownStats = PhysicsStats();
 }
 
 
 void Scene::SetCameraTarget(std::shared_ptr<Entity> target)
 {
-    cameraTarget = target;
+    cameraTarget = target ? target->getId() : EntityId();
 }
 
-void Scene::RegisterEntities()
+void Scene::Unload()
 {
-    systemManager->addAllEntitiesToSystems(Entity::getAllEntities());
+    world->discardCommands();
+    world->clear();
 }
 
-void Scene::Unload()
+void Scene::followCameraTarget()
 {
-    Entity::destroyAllEntities();
+    if (Entity* target = world->getEntity(cameraTarget)) {
+        cam->lookAt(target->getComponent<TransformComponent>()->getPosition());
+    }
 }
 
+// One simulation step of fixedTimeStep
 void Scene::Update()
 {
-    if (cameraTarget) {
-        cam->lookAt(cameraTarget->getComponent<TransformComponent>()->getPosition());
-    }
+    followCameraTarget();
     worldSpaceSystem->update();
-    scriptSystem->update(deltaTime);
+    scriptSystem->update(fixedTimeStep);
+    physicsSystem->integrateForces();
     collisionSystem->update();
-    physicsSystem->update(deltaTime);
+    physicsSystem->update(fixedTimeStep);
+    showPhysicsStats();
+
+    // Sync point: structural changes recorded by the systems above are applied here
+    world->playbackCommands();
+}
+
+// Body counts go in the window title, which is only touched when they change
+void Scene::showPhysicsStats()
+{
+    const PhysicsStats& stats = physicsSystem->getStats();
+    if (stats == shownStats) {
+        return;
+    }
+    shownStats = stats;
+    std::string title = sceneName + " - awake: " + std::to_string(stats.awake) + ", sleeping: " +
+        std::to_string(stats.sleeping) + ", islands: " + std::to_string(stats.islands);
+    SDL_SetWindowTitle(Renderer::Instance().GetWindow(), title.c_str());
 }
 
+// Draws the state between the last two steps that matches the time left over in the accumulator
 void Scene::Render()
 {
+    float alpha = accumulator / fixedTimeStep;
+    renderSystem->setInterpolation(alpha, worldSpaceSystem->getRun(), worldSpaceSystem->getInterpolatedCameraAffine(alpha));
     renderSystem->update(deltaTime);
 }
 
@@ -93,7 +142,7 @@ void Scene::Run()
     SDL_Event event;
 
     scriptSystem->start();
-    while (sceneName == SceneManager::GetCurrentScene()) {
+    while (sceneName == SceneManager::GetCurrentScene() && !SceneManager::IsSwitchPending()) {
 
         deltaTime = timer->GetDeltaTime();
 
@@ -106,7 +155,24 @@ void Scene::Run()
             InputSystem::getInstance().update(event);
         }
 
-        Update();
+        accumulator += deltaTime;
+        int steps = 0;
+        while (accumulator >= fixedTimeStep && steps < maxStepsPerFrame && !SceneManager::IsSwitchPending()) {
+            Update();
+            accumulator -= fixedTimeStep;
+            steps++;
+        }
+        if (accumulator >= fixedTimeStep) {
+            // Too far behind: the time beyond the cap is dropped, so a hitch doesn't snowball
+            accumulator = std::fmod(accumulator, fixedTimeStep);
+        }
+
+        // World space matrices of the latest step; the ones they replace are what the renderer
+        // blends from. Without a new step the previous pair is blended further.
+        if (steps > 0) {
+            followCameraTarget();
+            worldSpaceSystem->update();
+        }
         Render();
     }
 }
@@ -116,3 +182,17 @@ void Scene::setShouldCollide(CollisionLayer layer1, CollisionLayer layer2, bool
     collisionSystem->collisionMatrix.setShouldCollide(layer1, layer2, shouldCollide);
 }
 
+void Scene::setBroadphase(BroadphaseType type)
+{
+    collisionSystem->setBroadphase(type);
+}
+
+void Scene::setFixedTimeStep(float seconds)
+{
+    fixedTimeStep = seconds;
+}
+
+void Scene::setMaxStepsPerFrame(int steps)
+{
+    maxStepsPerFrame = std::max(1, steps);
+}
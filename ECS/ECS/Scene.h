@@ -15,7 +15,6 @@ public:
     void Initialize();  
     virtual void Load() = 0;
     void SetCameraTarget(std::shared_ptr<Entity> target);
-    void RegisterEntities();
     void Unload();     
 
     void Update();
@@ -23,23 +22,39 @@ public:
     void Run();
 
     void setShouldCollide(CollisionLayer layer1, CollisionLayer layer2, bool shouldCollide);
+    void setBroadphase(BroadphaseType type);
+
+    // Length of a simulation step in seconds. Scripts, collisions and physics always advance by
+    // this much, however long the frames take.
+    void setFixedTimeStep(float seconds);
+    // Most steps run in one frame. Beyond it the simulation falls behind real time instead of
+    // spending ever longer catching up.
+    void setMaxStepsPerFrame(int steps);
  
     std::string GetName() const { return sceneName; }
+    World& GetWorld() { return *world; }
 private:
     std::string sceneName;
 
     QuitManager& quitManager;
 
     float deltaTime;
+    float fixedTimeStep;
+    int maxStepsPerFrame;
+    float accumulator; // Frame time not yet simulated
     std::unique_ptr<Timer> timer;
-    std::unique_ptr<SystemManager> systemManager;
+    std::unique_ptr<World> world;
     std::shared_ptr<RenderSystem> renderSystem;
     std::shared_ptr<WorldSpaceSystem> worldSpaceSystem;
     std::shared_ptr<CollisionSystem> collisionSystem;
     std::shared_ptr<PhysicsSystem> physicsSystem;
     std::shared_ptr<ScriptSystem> scriptSystem;
     std::shared_ptr<Camera> cam;
-    std::shared_ptr<Entity> cameraTarget;
+    EntityId cameraTarget;
+    PhysicsStats shownStats;
+
+    void showPhysicsStats();
+    void followCameraTarget();
 };
 
 class SceneManager {
@@ -48,8 +63,12 @@ public:
     static void AddScene(std::shared_ptr<Scene> scene);
     static void Run();
     static std::string GetCurrentScene();
+    static bool IsSwitchPending();
 private:
+    static void LoadScene(const std::string& sceneName);
+
     inline static std::map<std::string, std::shared_ptr<Scene>> scenes;
     inline static std::shared_ptr<Scene> currentScene;
+    inline static std::string pendingScene;
 };
 
@@ -0,0 +1,202 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <new>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+
+// Occupancy counters of a slab pool. Capacity counts every block carved out of a slab so far; the
+// ones not in use sit on the free list.
+struct SlabStats {
+    size_t blockSize = 0;
+    size_t slabs = 0;
+    size_t capacity = 0;
+    size_t used = 0;
+    size_t peak = 0;
+
+    float occupancy() const {
+        return capacity ? static_cast<float>(used) / capacity : 0.0f;
+    }
+
+    // Share of the reserved blocks that are sitting idle on the free list
+    float fragmentation() const {
+        return capacity ? 1.0f - occupancy() : 0.0f;
+    }
+};
+
+// Fixed-size block allocator. Blocks are carved out of large slabs and freed blocks go on an
+// intrusive free list, so allocating and freeing are a couple of pointer moves. Slabs are kept
+// until the pool is destroyed. A block can be handed back from whichever thread drops the last
+// reference to its object, so the pool takes a lock.
+template <size_t BlockSize, size_t BlockAlignment, size_t BlocksPerSlab = 256>
+class SlabPool {
+public:
+    static constexpr size_t Alignment = std::max(BlockAlignment, alignof(void*));
+    static constexpr size_t Stride = (std::max(BlockSize, sizeof(void*)) + Alignment - 1) & ~(Alignment - 1);
+
+    SlabPool() = default;
+
+    ~SlabPool() {
+        for (unsigned char* slab : slabs) {
+            ::operator delete(slab, std::align_val_t(Alignment));
+        }
+    }
+
+    SlabPool(const SlabPool&) = delete;
+    SlabPool& operator=(const SlabPool&) = delete;
+
+    void* allocate() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!freeList) {
+            grow();
+        }
+        FreeBlock* block = freeList;
+        freeList = block->next;
+        stats.used++;
+        stats.peak = std::max(stats.peak, stats.used);
+        return block;
+    }
+
+    void deallocate(void* ptr) {
+        std::lock_guard<std::mutex> lock(mutex);
+        FreeBlock* block = static_cast<FreeBlock*>(ptr);
+        block->next = freeList;
+        freeList = block;
+        stats.used--;
+    }
+
+    SlabStats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+    // One pool per block shape, shared by every type of that size and alignment. It is never
+    // destroyed, so objects released during static destruction can still hand their blocks back.
+    static SlabPool& instance() {
+        static SlabPool* pool = new SlabPool();
+        return *pool;
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    void grow() {
+        unsigned char* slab = static_cast<unsigned char*>(::operator new(Stride * BlocksPerSlab, std::align_val_t(Alignment)));
+        slabs.push_back(slab);
+
+        // Thread the new blocks onto the free list so they are handed out in address order
+        for (size_t i = BlocksPerSlab; i-- > 0;) {
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + i * Stride);
+            block->next = freeList;
+            freeList = block;
+        }
+
+        stats.blockSize = Stride;
+        stats.slabs++;
+        stats.capacity += BlocksPerSlab;
+    }
+
+    std::vector<unsigned char*> slabs;
+    FreeBlock* freeList = nullptr;
+    SlabStats stats;
+    mutable std::mutex mutex;
+};
+
+template <typename T>
+using SlabPoolFor = SlabPool<sizeof(T), alignof(T)>;
+
+// A private family of slab pools, one per block shape, created the first time a shape is asked
+// for. Nothing outside the set touches its pools, so two owners of separate sets never contend for
+// a lock or share a free list. The pools live as long as the set.
+class SlabPoolSet {
+public:
+    SlabPoolSet() = default;
+
+    SlabPoolSet(const SlabPoolSet&) = delete;
+    SlabPoolSet& operator=(const SlabPoolSet&) = delete;
+
+    template <typename T>
+    SlabPoolFor<T>& pool() {
+        using Pool = SlabPoolFor<T>;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Entry& entry : pools) {
+            if (entry.key == &key<Pool>) {
+                return *static_cast<Pool*>(entry.pool.get());
+            }
+        }
+        pools.push_back({ &key<Pool>, PoolPtr(new Pool(), [](void* pool) { delete static_cast<Pool*>(pool); }) });
+        return *static_cast<Pool*>(pools.back().pool.get());
+    }
+
+private:
+    // Only its address matters: one per pool type
+    template <typename Pool>
+    static constexpr char key = 0;
+
+    using PoolPtr = std::unique_ptr<void, void (*)(void*)>;
+    struct Entry {
+        const char* key;
+        PoolPtr pool;
+    };
+
+    std::vector<Entry> pools;
+    std::mutex mutex; // Only taken to find or add a pool
+};
+
+// Standard allocator on top of the slab pools. Single objects come from the pool for their size,
+// in the given set if there is one and in the process-wide pools otherwise; arrays fall back to the
+// global heap. Handy for std::allocate_shared and node-based containers. An allocator keeps its set
+// alive, so a container or control block can outlive whoever handed the set out.
+template <typename T>
+class SlabAllocator {
+public:
+    using value_type = T;
+
+    SlabAllocator() = default;
+
+    explicit SlabAllocator(std::shared_ptr<SlabPoolSet> set) :
+        set(std::move(set)), pool(this->set ? &this->set->template pool<T>() : nullptr) {}
+
+    template <typename U>
+    SlabAllocator(const SlabAllocator<U>& other) : SlabAllocator(other.set) {}
+
+    T* allocate(size_t count) {
+        if (count == 1) {
+            return static_cast<T*>(getPool().allocate());
+        }
+        return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(alignof(T))));
+    }
+
+    void deallocate(T* ptr, size_t count) {
+        if (count == 1) {
+            getPool().deallocate(ptr);
+        }
+        else {
+            ::operator delete(ptr, std::align_val_t(alignof(T)));
+        }
+    }
+
+    template <typename U>
+    bool operator==(const SlabAllocator<U>& other) const {
+        return set == other.set;
+    }
+
+    template <typename U>
+    bool operator!=(const SlabAllocator<U>& other) const {
+        return set != other.set;
+    }
+
+private:
+    template <typename U>
+    friend class SlabAllocator;
+
+    SlabPoolFor<T>& getPool() const {
+        return pool ? *pool : SlabPoolFor<T>::instance();
+    }
+
+    std::shared_ptr<SlabPoolSet> set;
+    SlabPoolFor<T>* pool = nullptr; // Looked up once, so allocating doesn't go through the set
+};
@@ -0,0 +1,217 @@
+// Checks the PC::Batch kernels against the scalar Vector2/Affine2D operators, on every lane width
+// the build supports. Release|x64 enables AVX2, so it covers the 8-wide paths as well; Debug|x64
+// stops at SSE2. Exits with a non-zero code if a result is further off than rounding allows.
+#include <cstdio>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <random>
+#include "../ECS/PCM.h"
+
+using namespace PC;
+
+namespace {
+	int failures = 0;
+
+	void check(bool passed, const char* kernel, const char* lanes, size_t count, size_t index) {
+		if (!passed) {
+			failures++;
+			std::printf("FAIL %s<%s> count %zu at %zu\n", kernel, lanes, count, index);
+		}
+	}
+
+	// Sizes around and between the 4 and 8 lane widths, so every remainder length is exercised
+	const size_t Counts[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 11, 13, 15, 16, 17, 31, 33, 100, 1023 };
+
+	std::mt19937 random(12345);
+
+	float next() {
+		return std::uniform_real_distribution<float>(-1000.0f, 1000.0f)(random);
+	}
+
+	std::vector<float> values(size_t count) {
+		std::vector<float> result(count);
+		for (float& value : result) {
+			value = next();
+		}
+		return result;
+	}
+
+	Affine2Df affine() {
+		return Affine2Df::fromTRS(Vector2f(next(), next()), next(), Vector2f(next() / 100.0f, next() / 100.0f));
+	}
+
+	// The kernels do the scalar operators' operations, but the compiler may contract a multiply and
+	// an add into one FMA (g++ -march=haswell, older MSVC with /arch:AVX2), in the kernel, the
+	// operator or both. So results are only compared up to a few roundings of the terms summed.
+	// magnitude is the sum of those terms' absolute values, which bounds the rounding error.
+	constexpr float MaxRoundings = 8.0f;
+
+	bool close(float actual, float expected, float magnitude) {
+		return std::abs(actual - expected) <= MaxRoundings * std::numeric_limits<float>::epsilon() * magnitude;
+	}
+
+	// actual against l * r, element by element
+	bool closeProduct(const Affine2Df& actual, const Affine2Df& l, const Affine2Df& r) {
+		Affine2Df expected = l * r;
+		return close(actual.a, expected.a, std::abs(l.a * r.a) + std::abs(l.b * r.c)) &&
+			close(actual.b, expected.b, std::abs(l.a * r.b) + std::abs(l.b * r.d)) &&
+			close(actual.c, expected.c, std::abs(l.c * r.a) + std::abs(l.d * r.c)) &&
+			close(actual.d, expected.d, std::abs(l.c * r.b) + std::abs(l.d * r.d)) &&
+			close(actual.tx, expected.tx, std::abs(l.a * r.tx) + std::abs(l.b * r.ty) + std::abs(l.tx)) &&
+			close(actual.ty, expected.ty, std::abs(l.c * r.tx) + std::abs(l.d * r.ty) + std::abs(l.ty));
+	}
+
+	// actual against m * (x, y)
+	bool closePoint(float actualX, float actualY, const Affine2Df& m, float x, float y) {
+		Vector2f expected = m * Vector2f(x, y);
+		return close(actualX, expected.x, std::abs(m.a * x) + std::abs(m.b * y) + std::abs(m.tx)) &&
+			close(actualY, expected.y, std::abs(m.c * x) + std::abs(m.d * y) + std::abs(m.ty));
+	}
+
+	template <typename L>
+	void testTransformPoints(const char* lanes) {
+		for (size_t count : Counts) {
+			Affine2Df m = affine();
+			std::vector<float> xs = values(count), ys = values(count);
+			std::vector<float> outX(count), outY(count);
+			Batch::transformPoints<L>(m, xs.data(), ys.data(), outX.data(), outY.data(), count);
+			for (size_t i = 0; i < count; i++) {
+				check(closePoint(outX[i], outY[i], m, xs[i], ys[i]), "transformPoints", lanes, count, i);
+			}
+
+			// In place
+			std::vector<float> inX = xs, inY = ys;
+			Batch::transformPoints<L>(m, xs.data(), ys.data(), xs.data(), ys.data(), count);
+			for (size_t i = 0; i < count; i++) {
+				check(closePoint(xs[i], ys[i], m, inX[i], inY[i]), "transformPoints in place", lanes, count, i);
+			}
+		}
+	}
+
+	template <typename L>
+	void testMultiplyAffines(const char* lanes) {
+		for (size_t count : Counts) {
+			std::vector<Affine2Df> lhs(count), rhs(count), out(count);
+			for (size_t i = 0; i < count; i++) {
+				lhs[i] = affine();
+				rhs[i] = affine();
+			}
+			Batch::multiplyAffines<L>(lhs.data(), rhs.data(), out.data(), count);
+			for (size_t i = 0; i < count; i++) {
+				check(closeProduct(out[i], lhs[i], rhs[i]), "multiplyAffines", lanes, count, i);
+			}
+
+			Affine2Df camera = affine();
+			Batch::multiplyAffines<L>(camera, rhs.data(), out.data(), count);
+			for (size_t i = 0; i < count; i++) {
+				check(closeProduct(out[i], camera, rhs[i]), "multiplyAffines by one", lanes, count, i);
+			}
+
+			// In place, with the left-hand side being one of the outputs
+			if (count > 0) {
+				std::vector<Affine2Df> in = rhs;
+				Batch::multiplyAffines<L>(rhs[0], rhs.data(), rhs.data(), count);
+				for (size_t i = 0; i < count; i++) {
+					check(closeProduct(rhs[i], in[0], in[i]), "multiplyAffines in place", lanes, count, i);
+				}
+			}
+		}
+	}
+
+	template <typename L>
+	void testMultiplyAffineArrays(const char* lanes) {
+		for (size_t count : Counts) {
+			std::vector<Affine2Df> lhs(count), rhs(count);
+			Batch::AffineBuffer left, right, out;
+			left.resize(count);
+			right.resize(count);
+			out.resize(count);
+			for (size_t i = 0; i < count; i++) {
+				lhs[i] = affine();
+				rhs[i] = affine();
+				left.set(i, lhs[i]);
+				right.set(i, rhs[i]);
+			}
+			Batch::multiplyAffines<L>(left.arrays(), right.arrays(), out.arrays(), count);
+			for (size_t i = 0; i < count; i++) {
+				check(closeProduct(out.get(i), lhs[i], rhs[i]), "multiplyAffines arrays", lanes, count, i);
+			}
+
+			Affine2Df camera = affine();
+			Batch::multiplyAffines<L>(camera, right.arrays(), out.arrays(), count);
+			for (size_t i = 0; i < count; i++) {
+				check(closeProduct(out.get(i), camera, rhs[i]), "multiplyAffines arrays by one", lanes, count, i);
+			}
+
+			// In place
+			Batch::multiplyAffines<L>(left.arrays(), right.arrays(), right.arrays(), count);
+			for (size_t i = 0; i < count; i++) {
+				check(closeProduct(right.get(i), lhs[i], rhs[i]), "multiplyAffines arrays in place", lanes, count, i);
+			}
+			Batch::multiplyAffines<L>(camera, left.arrays(), left.arrays(), count);
+			for (size_t i = 0; i < count; i++) {
+				check(closeProduct(left.get(i), camera, lhs[i]), "multiplyAffines arrays by one in place", lanes, count, i);
+			}
+		}
+	}
+
+	template <typename L>
+	void testDotProducts(const char* lanes) {
+		for (size_t count : Counts) {
+			std::vector<float> ax = values(count), ay = values(count), bx = values(count), by = values(count);
+			std::vector<float> out(count);
+			Batch::dotProducts<L>(ax.data(), ay.data(), bx.data(), by.data(), out.data(), count);
+			for (size_t i = 0; i < count; i++) {
+				check(close(out[i], Vector2f(ax[i], ay[i]).dotProduct(Vector2f(bx[i], by[i])), std::abs(ax[i] * bx[i]) + std::abs(ay[i] * by[i])),
+					"dotProducts", lanes, count, i);
+			}
+
+			Vector2f axis(next(), next());
+			Batch::dotProducts<L>(axis, ax.data(), ay.data(), out.data(), count);
+			for (size_t i = 0; i < count; i++) {
+				check(close(out[i], axis.dotProduct(Vector2f(ax[i], ay[i])), std::abs(axis.x * ax[i]) + std::abs(axis.y * ay[i])),
+					"dotProducts onto axis", lanes, count, i);
+			}
+		}
+	}
+
+	template <typename L>
+	void testMagnitudes(const char* lanes) {
+		for (size_t count : Counts) {
+			std::vector<float> xs = values(count), ys = values(count);
+			std::vector<float> out(count);
+			Batch::magnitudes<L>(xs.data(), ys.data(), out.data(), count);
+			for (size_t i = 0; i < count; i++) {
+				float expected = Vector2f(xs[i], ys[i]).magnitude();
+				check(close(out[i], expected, expected), "magnitudes", lanes, count, i);
+			}
+		}
+	}
+
+	template <typename L>
+	void testLanes(const char* lanes) {
+		int before = failures;
+		testTransformPoints<L>(lanes);
+		testMultiplyAffines<L>(lanes);
+		testMultiplyAffineArrays<L>(lanes);
+		testDotProducts<L>(lanes);
+		testMagnitudes<L>(lanes);
+		std::printf("%-6s %s\n", lanes, failures == before ? "ok" : "FAILED");
+	}
+}
+
+int main() {
+	testLanes<Batch::ScalarLanes>("scalar");
+#if defined(PC_SIMD_SSE2)
+	testLanes<Batch::SSELanes>("SSE2");
+#else
+	std::printf("SSE2   not enabled in this build\n");
+#endif
+#if defined(PC_SIMD_AVX2)
+	testLanes<Batch::AVXLanes>("AVX2");
+#else
+	std::printf("AVX2   not enabled in this build\n");
+#endif
+	return failures == 0 ? 0 : 1;
+}